@@ -0,0 +1,280 @@
+// UARTServoBenchmark.cpp
+//
+// Benchmarks of the library hot paths on a host: frame encoding, response parsing and
+// request-to-callback latency against the virtual servo bus.
+// Results are printed as JSON lines, one object per measurement.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++11 -Isrc/UARTServo extras/benchmark/UARTServoBenchmark.cpp src/UARTServo/*.cpp -o uartservo-benchmark
+// Add -DSERVO_STATISTICS to measure the cost of the bus statistics.
+// Run:
+//   ./uartservo-benchmark [--pty]
+
+#include "ByteBuffer.h"
+#include "LoopbackTransport.h"
+#include "PtyTransport.h"
+#include "ServoSimulator.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#define ENCODE_ITERATIONS	1000000
+#define PARSE_FRAMES		200000
+#define LATENCY_SAMPLES		20000
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Transport dropping every written byte, so that encoding is measured alone.
+class NullTransport : public UARTTransport
+{
+public:
+	NullTransport() : written(0) {}
+	bool begin(unsigned long) { return true; }
+	size_t available() { return 0; }
+	size_t read(byte*, size_t) { return 0; }
+	size_t write(const byte*, size_t size) { written += size; return size; }
+	unsigned long long written;
+};
+
+static void report(const char* benchmark, const char* name, const char* unit, double value)
+{
+	printf("{\"benchmark\":\"%s\",\"name\":\"%s\",\"%s\":%.1f}\n", benchmark, name, unit, value);
+}
+
+#define BENCH_ENCODE(name, call) \
+	{ \
+		double start = now(); \
+		for (long i = 0; i < ENCODE_ITERATIONS; i++) \
+		{ \
+			byte id = (byte)(i & 0x3f); \
+			call; \
+		} \
+		report("encode", name, "frames_per_sec", ENCODE_ITERATIONS / (now() - start)); \
+	}
+
+static void benchEncode()
+{
+	NullTransport transport;
+	UARTServo servo;
+	servo.begin(&transport);
+	unsigned int value = 7400;
+	UserParameter parameter;
+	memset(&parameter, 0, sizeof(parameter));
+
+	BENCH_ENCODE("ping", servo.ping(id, NULL));
+	BENCH_ENCODE("resetUserData", servo.resetUserData(id, NULL));
+	BENCH_ENCODE("readData", servo.readData(id, 1, NULL));
+	BENCH_ENCODE("writeData", servo.writeData(id, 39, &value, 2, NULL));
+	BENCH_ENCODE("readBatchData", servo.readBatchData(id, NULL));
+	BENCH_ENCODE("writeBatchData", servo.writeBatchData(id, &parameter, NULL));
+	BENCH_ENCODE("spin", servo.spin(id, SPIN_CLOCKWISE | SPIN_START, 360, 0));
+	BENCH_ENCODE("rotate", servo.rotate(id, (int)i & 0x3ff, 1000));
+	BENCH_ENCODE("rotateByInterval", servo.rotateByInterval(id, (int)i & 0x3ff, 1000, 100, 100));
+	BENCH_ENCODE("rotateByVelocity", servo.rotateByVelocity(id, (int)i & 0x3ff, 360, 100, 100));
+	BENCH_ENCODE("damping", servo.damping(id, 500));
+	BENCH_ENCODE("readAngle", servo.readAngle(id, NULL));
+
+	ServoMotion motions[12];
+	for (byte j = 0; j < 12; j++)
+	{
+		ServoMotion motion = { j, 0, 1000, 100, 100, 0 };
+		motions[j] = motion;
+	}
+	double start = now();
+	for (long i = 0; i < ENCODE_ITERATIONS / 12; i++)
+	{
+		motions[0].angle = (int)i & 0x3ff;
+		servo.rotateGroup(motions, 12);
+	}
+	report("encode", "rotateGroup12", "frames_per_sec", ENCODE_ITERATIONS / 12 * 12 / (now() - start));
+	// Use the written bytes, so that the encoding can not be optimized away.
+	report("encode", "total", "bytes", (double)transport.written);
+}
+
+static unsigned long parsedFrames = 0;
+
+static void countAngle(byte, int)
+{
+	parsedFrames++;
+}
+
+// Build a stream of read angle responses, optionally with noise between frames and corrupted checksums.
+static std::vector<byte> makeResponseStream(bool noisy)
+{
+	std::vector<byte> stream;
+	unsigned int seed = 7;
+	for (long i = 0; i < PARSE_FRAMES; i++)
+	{
+		if (noisy && rand_r(&seed) % 4 == 0)
+		{
+			// Bytes that look like the start of a header.
+			stream.push_back(0x05);
+			stream.push_back(0x05);
+			stream.push_back((byte)rand_r(&seed));
+		}
+		byte frame[8];
+		FrameWriter writer(frame, sizeof(frame));
+		writer.begin(RESPONSE_HEADER, PACKET_READ_ANGLE, 3);
+		writer.write((byte)(i & 0x3f));
+		writer.writeInt((int)(i & 0x3ff));
+		size_t length = writer.end();
+		if (noisy && rand_r(&seed) % 16 == 0)
+		{
+			frame[length - 1] ^= 0x01;
+		}
+		stream.insert(stream.end(), frame, frame + length);
+	}
+	return stream;
+}
+
+static void benchParse(bool noisy, size_t chunk)
+{
+	std::vector<byte> stream = makeResponseStream(noisy);
+	NullTransport transport;
+	UARTServo servo;
+	servo.begin(&transport);
+	servo.setTimeout(0);
+	parsedFrames = 0;
+
+	double elapsed = 0;
+	size_t position = 0;
+	while (position < stream.size())
+	{
+		// Keep one request pending per servo so every response is dispatched.
+		while (servo.getFreeRequestSlots() > 0)
+		{
+			servo.readAngle((byte)(position & 0x3f), countAngle);
+		}
+		size_t size = std::min(chunk * 64, stream.size() - position);
+		double start = now();
+		for (size_t i = 0; i < size; i += chunk)
+		{
+			servo.feed(&stream[position + i], std::min(chunk, size - i));
+		}
+		elapsed += now() - start;
+		position += size;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "%s_chunk%u", noisy ? "noisy" : "clean", (unsigned)chunk);
+	report("parse", name, "bytes_per_sec", stream.size() / elapsed);
+}
+
+template<unsigned int N>
+static void benchByteBuffer()
+{
+	ByteBuffer<N> buffer;
+	byte data[64];
+	memset(data, 0x5a, sizeof(data));
+	const long rounds = 2000000;
+
+	double start = now();
+	for (long i = 0; i < rounds; i++)
+	{
+		buffer.write(data, sizeof(data));
+		buffer.read(data, sizeof(data));
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "ByteBuffer<%u>_bulk", N);
+	report("buffer", name, "bytes_per_sec", rounds * sizeof(data) / (now() - start));
+
+	start = now();
+	for (long i = 0; i < rounds; i++)
+	{
+		for (size_t j = 0; j < sizeof(data); j++)
+		{
+			buffer.write(data[j]);
+		}
+		for (size_t j = 0; j < sizeof(data); j++)
+		{
+			data[j] = buffer.read();
+		}
+	}
+	snprintf(name, sizeof(name), "ByteBuffer<%u>_bytewise", N);
+	report("buffer", name, "bytes_per_sec", rounds * sizeof(data) / (now() - start));
+}
+
+static double requestTime = 0;
+static std::vector<double> latencies;
+
+static void recordAngle(byte, int)
+{
+	latencies.push_back(now() - requestTime);
+}
+
+static void benchLatency(const char* name, UARTServo& servo, ServoSimulator& simulator)
+{
+	latencies.clear();
+	latencies.reserve(LATENCY_SAMPLES);
+	for (long i = 0; i < LATENCY_SAMPLES; i++)
+	{
+		size_t count = latencies.size();
+		requestTime = now();
+		servo.readAngle(1, recordAngle);
+		while (latencies.size() == count && now() - requestTime < 0.1)
+		{
+			simulator.update();
+			servo.update();
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	if (latencies.empty())
+	{
+		return;
+	}
+	printf("{\"benchmark\":\"latency\",\"name\":\"%s\",\"samples\":%u,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+		name, (unsigned)latencies.size(),
+		latencies[latencies.size() / 2] * 1e6,
+		latencies[latencies.size() * 99 / 100] * 1e6,
+		latencies.back() * 1e6);
+}
+
+int main(int argc, char** argv)
+{
+	bool pty = argc > 1 && strcmp(argv[1], "--pty") == 0;
+
+	benchEncode();
+	benchParse(false, 1);
+	benchParse(false, 64);
+	benchParse(true, 1);
+	benchParse(true, 64);
+	benchByteBuffer<256>();
+	benchByteBuffer<4096>();
+
+	{
+		LoopbackTransport host, bus;
+		host.connect(&bus);
+		ServoSimulator simulator;
+		simulator.begin(&bus);
+		simulator.addServo(1);
+		UARTServo servo;
+		servo.begin(&host);
+		benchLatency("loopback", servo, simulator);
+	}
+
+	if (pty)
+	{
+		PtyTransport bus;
+		ServoSimulator simulator;
+		if (simulator.begin(&bus, 500000))
+		{
+			simulator.addServo(1);
+			TermiosTransport host(bus.getSlaveName());
+			UARTServo servo;
+			if (servo.begin(&host, 500000))
+			{
+				benchLatency("pty", servo, simulator);
+			}
+		}
+	}
+	return 0;
+}
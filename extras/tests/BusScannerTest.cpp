@@ -0,0 +1,170 @@
+// BusScannerTest.cpp
+//
+// Loopback test of BusScanner: lost responses, late responses, and the requests cancelled at their deadline.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -Isrc/UARTServo -Iextras/tests extras/tests/BusScannerTest.cpp src/UARTServo/*.cpp -o bus-scanner-test
+// Run:
+//   ./bus-scanner-test
+
+#include "LoopbackTest.h"
+#include "BusScanner.h"
+
+/// Servos on the bus, the other IDs are silent.
+#define FIRST_SERVO		3
+#define SECOND_SERVO	7
+/// Data ID of the serial number, the last identity field.
+#define SERIAL_NUMBER	8
+
+struct Script
+{
+	/// Servo whose responses are lost, ALL_SERVOS for none.
+	byte drop;
+	/// Servo whose responses are held back, ALL_SERVOS for none.
+	byte hold;
+	/// Data ID of the read data requests held back, zero for all requests of the held servo.
+	byte holdDataID;
+};
+
+static ScriptAction answer(byte number, const byte* payload, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	byte id = payload[0];
+	if (id == script->drop || (id != FIRST_SERVO && id != SECOND_SERVO && id != script->hold))
+	{
+		return REPLY_DROP;
+	}
+	if (id == script->hold && (script->holdDataID == 0 || (number == PACKET_READ_DATA && payload[1] == script->holdDataID)))
+	{
+		return REPLY_HOLD;
+	}
+	return REPLY_NOW;
+}
+
+static int finished = 0;
+static byte finishCount = 0;
+static int infos = 0;
+static unsigned long infoSerialNumber = 0;
+
+static void onFinish(byte count)
+{
+	finished++;
+	finishCount = count;
+}
+
+static void onInfo(byte, unsigned int, unsigned int, unsigned long serialNumber)
+{
+	infos++;
+	infoSerialNumber = serialNumber;
+}
+
+/// Run a scan to its end, or for a second at most.
+static void scan(ScriptedServo& bus, UARTServo& servo, BusScanner& scanner, byte firstID, byte lastID)
+{
+	finished = 0;
+	scanner.start(servo, firstID, lastID);
+	unsigned long start = millis();
+	while (scanner.isRunning() && millis() - start < 1000)
+	{
+		bus.run(servo, 1);
+	}
+}
+
+// A servo whose ping is lost is not found, the servos answering are, and the scan finishes.
+static void testLostResponse()
+{
+	Script script = { 5, ALL_SERVOS, 0 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	BusScanner scanner;
+	servo.attach(&scanner);
+	scanner.setFinishCallback(onFinish);
+
+	scan(bus, servo, scanner, 0, 10);
+	CHECK(finished == 1);
+	CHECK(finishCount == 2);
+	CHECK(scanner.isFound(FIRST_SERVO));
+	CHECK(scanner.isFound(SECOND_SERVO));
+	CHECK(!scanner.isFound(5));
+	CHECK(bus.getRequests() == 11);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	servo.detach(&scanner);
+}
+
+// A ping or an identity read answered after its deadline is not counted, the late responses change nothing.
+static void testLateResponse()
+{
+	Script script = { ALL_SERVOS, 5, 0 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	BusScanner scanner;
+	servo.attach(&scanner);
+	scanner.setFinishCallback(onFinish);
+
+	scan(bus, servo, scanner, 0, 10);
+	CHECK(finished == 1);
+	CHECK(finishCount == 2);
+	bus.release();
+	bus.run(servo, 10);
+	CHECK(scanner.getCount() == 2);
+	CHECK(!scanner.isFound(5));
+
+	script.hold = FIRST_SERVO;
+	script.holdDataID = SERIAL_NUMBER;
+	scanner.setInfoCallback(onInfo);
+	infos = 0;
+	scan(bus, servo, scanner, FIRST_SERVO, FIRST_SERVO);
+	CHECK(finished == 1);
+	CHECK(infos == 1);
+	CHECK(infoSerialNumber == 0);
+	bus.release();
+	bus.run(servo, 10);
+	CHECK(infos == 1);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	servo.detach(&scanner);
+}
+
+// The requests cancelled at their deadline do not reach the next scan.
+static void testCancel()
+{
+	Script script = { ALL_SERVOS, 5, 0 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	BusScanner scanner;
+	servo.attach(&scanner);
+	scanner.setFinishCallback(onFinish);
+
+	scan(bus, servo, scanner, 5, 5);
+	CHECK(finished == 1);
+	CHECK(finishCount == 0);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+
+	// The held ping response of the first scan arrives during the second one.
+	script.hold = ALL_SERVOS;
+	script.drop = 5;
+	scanner.start(servo, 5, 5);
+	bus.release();
+	unsigned long start = millis();
+	while (scanner.isRunning() && millis() - start < 1000)
+	{
+		bus.run(servo, 1);
+	}
+	CHECK(!scanner.isRunning());
+	CHECK(scanner.getCount() == 0);
+	CHECK(!scanner.isFound(5));
+	servo.detach(&scanner);
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testCancel();
+	return reportTest("bus scanner");
+}
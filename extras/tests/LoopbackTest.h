@@ -0,0 +1,217 @@
+// LoopbackTest.h
+//
+// Helpers of the loopback tests: a check macro and a scripted bus end.
+
+#ifndef LOOPBACKTEST_H
+#define LOOPBACKTEST_H
+
+#include "FrameParser.h"
+#include "LoopbackTransport.h"
+#include "UARTServo.h"
+
+#include <stdio.h>
+
+/// Print a failed condition and count it, the test returns the number of failures.
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+static int testFailures = 0;
+
+/// Print the result of a test, the value to return from main().
+inline int reportTest(const char* name)
+{
+	if (testFailures == 0)
+	{
+		printf("%s: passed\n", name);
+	}
+	else
+	{
+		printf("%s: %d checks failed\n", name, testFailures);
+	}
+	return testFailures;
+}
+
+/// What a script does with the response of a request.
+enum ScriptAction
+{
+	/// Send the response at once.
+	REPLY_NOW,
+	/// Lose the request, no response is sent.
+	REPLY_DROP,
+	/// Keep the response until ScriptedServo::release().
+	REPLY_HOLD
+};
+
+/*!
+ * ScriptedServo class
+ * Bus end answering every request like a servo would, through a script of the test
+ * that can lose a response or hold it back to send it late.
+ * By default it is connected to the UARTServo object by a loopback transport, another transport can be given instead,
+ * e.g. the master side of a pseudo terminal for a UARTServo object running on another thread.
+ */
+class ScriptedServo
+{
+public:
+	/*!
+	 * Decide on the response of a request.
+	 *
+	 * \param number Packet number of the request.
+	 * \param payload Request payload, starting with the servo ID.
+	 * \param reply Default response payload, it may be changed.
+	 * \param size Size of the response payload, it may be changed.
+	 */
+	typedef ScriptAction(*Script)(byte number, const byte* payload, byte length, byte* reply, byte* size, void* context);
+
+	ScriptedServo()
+		: _bus(&_transport), _parser(REQUEST_HEADER), _script(NULL), _context(NULL), _heldLength(0), _requests(0)
+	{
+		_transport.connect(&_host);
+	}
+
+	/*!
+	 * \param bus Transport to answer on, begun by the caller.
+	 */
+	ScriptedServo(UARTTransport* bus)
+		: _bus(bus), _parser(REQUEST_HEADER), _script(NULL), _context(NULL), _heldLength(0), _requests(0)
+	{
+	}
+
+	/// Transport to begin the UARTServo object with, without a transport given to the constructor.
+	UARTTransport* getTransport()
+	{
+		return &_host;
+	}
+
+	void setScript(Script script, void* context = NULL)
+	{
+		_script = script;
+		_context = context;
+	}
+
+	/// Answer the requests received so far.
+	void update()
+	{
+		byte buffer[64];
+		size_t size;
+		while ((size = _bus->read(buffer, sizeof(buffer))) > 0)
+		{
+			size_t offset = 0;
+			while (offset < size)
+			{
+				offset += _parser.parse(buffer + offset, size - offset);
+				if (_parser.isComplete())
+				{
+					answer(_parser.getNumber(), _parser.getPayload(), _parser.getLength());
+				}
+			}
+		}
+	}
+
+	/*!
+	 * Run a UARTServo object on this bus for a while.
+	 *
+	 * \param time Time to run(unit: millisecond).
+	 */
+	void run(UARTServo& servo, unsigned long time)
+	{
+		unsigned long start = millis();
+		do
+		{
+			servo.update();
+			update();
+		} while (millis() - start < time);
+	}
+
+	/// Send the held responses.
+	void release()
+	{
+		_bus->write(_held, _heldLength);
+		_heldLength = 0;
+	}
+
+	/// Number of requests received.
+	unsigned long getRequests() const
+	{
+		return _requests;
+	}
+
+private:
+	LoopbackTransport _host;
+	LoopbackTransport _transport;
+	UARTTransport* _bus;
+	FrameParser _parser;
+	Script _script;
+	void* _context;
+	byte _held[1024];
+	size_t _heldLength;
+	unsigned long _requests;
+
+	void answer(byte number, const byte* payload, byte length)
+	{
+		_requests++;
+		if (payload[0] == ALL_SERVOS)
+		{
+			return;
+		}
+		byte reply[1 + USER_DATA_SIZE] = { payload[0] };
+		byte size = 2;
+		reply[1] = 1;
+		switch (number)
+		{
+			case PACKET_PING:
+				size = 1;
+				break;
+			case PACKET_READ_DATA:
+			{
+				// The data ID and a value of its size, 2 bytes for the IDs out of the data table.
+				byte dataSize = getDataSize(payload[1]);
+				size = 2 + ((dataSize > 0) ? dataSize : 2);
+				reply[1] = payload[1];
+				for (byte i = 2; i < size; i++)
+				{
+					reply[i] = i;
+				}
+				break;
+			}
+			case PACKET_WRITE_DATA:
+				size = 3;
+				reply[1] = payload[1];
+				reply[2] = 1;
+				break;
+			case PACKET_READ_BATCH_DATA:
+				size = 1 + USER_DATA_SIZE;
+				break;
+			case PACKET_READ_ANGLE:
+				size = 3;
+				reply[1] = 100;
+				reply[2] = 0;
+				break;
+		}
+		ScriptAction action = (_script != NULL) ? _script(number, payload, length, reply, &size, _context) : REPLY_NOW;
+		if (action == REPLY_DROP)
+		{
+			return;
+		}
+		byte frame[MAX_FRAME_LENGTH];
+		FrameWriter writer(frame, sizeof(frame));
+		writer.begin(RESPONSE_HEADER, number, size);
+		writer.write(reply, size);
+		size_t frameLength = writer.end();
+		if (action == REPLY_HOLD && _heldLength + frameLength <= sizeof(_held))
+		{
+			memcpy(_held + _heldLength, frame, frameLength);
+			_heldLength += frameLength;
+			return;
+		}
+		_bus->write(frame, frameLength);
+	}
+};
+
+#endif
@@ -0,0 +1,157 @@
+// ParameterCacheTest.cpp
+//
+// Loopback test of ParameterCache: lost responses, late responses, and clear() with requests in flight.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -Isrc/UARTServo -Iextras/tests extras/tests/ParameterCacheTest.cpp src/UARTServo/*.cpp -o parameter-cache-test
+// Run:
+//   ./parameter-cache-test
+
+#include "LoopbackTest.h"
+#include "ParameterCache.h"
+
+/// Written fields, few enough to be sent by the write data command.
+#define FIRST_FIELD		(USER_DATA_FIRST_ID + 4)
+#define SECOND_FIELD	(USER_DATA_FIRST_ID + 5)
+
+struct Script
+{
+	/// Packet number whose responses are lost or held, zero for none and ALL_SERVOS for all.
+	byte number;
+	/// Data ID of a write data request whose response is lost or held, zero for all.
+	byte dataID;
+	/// Lost or held.
+	ScriptAction action;
+};
+
+static ScriptAction answer(byte number, const byte* payload, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	if ((number == script->number || script->number == ALL_SERVOS) && (script->dataID == 0 || payload[1] == script->dataID))
+	{
+		return script->action;
+	}
+	return REPLY_NOW;
+}
+
+static int commits = 0;
+static byte commitResult = 0xff;
+
+static void onCommit(byte, byte result)
+{
+	commits++;
+	commitResult = result;
+}
+
+// A lost write fails the commit and keeps only its own field dirty, the next commit writes it again.
+static void testLostResponse()
+{
+	Script script = { PACKET_WRITE_DATA, FIRST_FIELD, REPLY_DROP };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ParameterCache cache;
+	servo.attach(&cache);
+	cache.setCommitCallback(onCommit);
+	int index = cache.add(1);
+	cache.set(index, FIRST_FIELD, 5);
+	cache.set(index, SECOND_FIELD, 6);
+
+	commits = 0;
+	cache.commit(index);
+	servo.update();
+	// Nothing to send while the commit waits for its responses.
+	CHECK(cache.getPollDelay(millis()) == POLL_IDLE);
+	bus.run(servo, 50);
+	CHECK(commits == 1);
+	CHECK(commitResult == 0);
+	CHECK(!cache.isCommitting(index));
+	CHECK(cache.isDirty(index));
+
+	script.number = 0;
+	cache.commit(index);
+	bus.run(servo, 50);
+	CHECK(commits == 2);
+	CHECK(commitResult == 1);
+	CHECK(!cache.isDirty(index));
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	servo.detach(&cache);
+}
+
+// A write answered after its timeout fails the commit, the late response changes nothing.
+static void testLateResponse()
+{
+	Script script = { PACKET_WRITE_DATA, FIRST_FIELD, REPLY_HOLD };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ParameterCache cache;
+	servo.attach(&cache);
+	cache.setCommitCallback(onCommit);
+	int index = cache.add(1);
+	cache.set(index, FIRST_FIELD, 5);
+	cache.set(index, SECOND_FIELD, 6);
+
+	commits = 0;
+	cache.commit(index);
+	bus.run(servo, 50);
+	CHECK(commits == 1);
+	CHECK(commitResult == 0);
+
+	script.number = 0;
+	bus.release();
+	bus.run(servo, 20);
+	CHECK(commits == 1);
+	CHECK(cache.isDirty(index));
+
+	cache.commit(index);
+	bus.run(servo, 50);
+	CHECK(commits == 2);
+	CHECK(commitResult == 1);
+	servo.detach(&cache);
+}
+
+// clear() cancels the requests in flight, their responses do not reach the servos added next.
+static void testClear()
+{
+	Script script = { ALL_SERVOS, 0, REPLY_HOLD };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(0);
+	ParameterCache cache;
+	servo.attach(&cache);
+	int index = cache.add(1);
+	cache.load(index);
+	cache.set(index, FIRST_FIELD, 5);
+	cache.commit(index);
+
+	bus.run(servo, 5);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS - 2);
+	cache.clear();
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	CHECK(cache.getCount() == 0);
+
+	script.number = 0;
+	bus.release();
+	servo.update();
+	index = cache.add(1);
+	CHECK(!cache.isLoaded(index));
+	cache.load(index);
+	bus.run(servo, 20);
+	CHECK(cache.isLoaded(index));
+	servo.detach(&cache);
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testClear();
+	return reportTest("parameter cache");
+}
@@ -0,0 +1,164 @@
+// ServoCoroutineTest.cpp
+//
+// Loopback test of ServoBus coroutines: lost responses, late responses, detached coroutines and broadcasts.
+//
+// Build from the repository root:
+//   g++ -std=c++20 -Isrc/UARTServo -Iextras/tests extras/tests/ServoCoroutineTest.cpp src/UARTServo/*.cpp -o servo-coroutine-test
+// Run:
+//   ./servo-coroutine-test
+
+#include "LoopbackTest.h"
+#include "ServoCoroutine.h"
+
+struct Script
+{
+	/// Packet numbers whose responses are lost or held, zero for none.
+	byte number;
+	byte otherNumber;
+	/// Lost or held.
+	ScriptAction action;
+};
+
+static ScriptAction answer(byte number, const byte*, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	return (number == script->number || number == script->otherNumber) ? script->action : REPLY_NOW;
+}
+
+/// Results of the awaited commands, in order.
+struct Trace
+{
+	byte status[4];
+	int value[4];
+	int count;
+};
+
+static ServoRoutine readTwice(CoroutinePool&, ServoBus& bus, Trace& trace)
+{
+	ServoResult<int> angle = co_await bus.readAngle(1);
+	trace.status[trace.count] = angle.status;
+	trace.value[trace.count++] = angle.value;
+	ServoResult<byte> ping = co_await bus.ping(1);
+	trace.status[trace.count] = ping.status;
+	trace.value[trace.count++] = ping.value;
+}
+
+static ServoRoutine dampAll(CoroutinePool&, ServoBus& bus, Trace& trace)
+{
+	ServoResult<byte> result = co_await bus.damping(ALL_SERVOS);
+	trace.status[trace.count++] = result.status;
+}
+
+/// Run until a coroutine is finished, or for a second at most.
+static void finish(ScriptedServo& bus, UARTServo& servo, const ServoRoutine& routine)
+{
+	unsigned long start = millis();
+	while (!routine.isDone() && millis() - start < 1000)
+	{
+		bus.run(servo, 1);
+	}
+}
+
+// A lost response resumes the coroutine with AWAIT_TIMEOUT, the next command goes on normally.
+static void testLostResponse()
+{
+	Script script = { PACKET_READ_ANGLE, 0, REPLY_DROP };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ServoBus awaiter(servo);
+	StaticCoroutinePool<1024, 2> pool;
+	Trace trace = {};
+
+	{
+		ServoRoutine routine = readTwice(pool, awaiter, trace);
+		CHECK(routine.isValid());
+		finish(bus, servo, routine);
+		CHECK(routine.isDone());
+	}
+	CHECK(trace.count == 2);
+	CHECK(trace.status[0] == AWAIT_TIMEOUT);
+	CHECK(trace.status[1] == AWAIT_OK);
+	CHECK(trace.value[1] == 1);
+	CHECK(pool.getFree() == 2);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+}
+
+// A response arriving after its timeout does not resume the coroutine again.
+static void testLateResponse()
+{
+	Script script = { PACKET_READ_ANGLE, PACKET_PING, REPLY_HOLD };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ServoBus awaiter(servo);
+	StaticCoroutinePool<1024, 2> pool;
+	Trace trace = {};
+
+	{
+		ServoRoutine routine = readTwice(pool, awaiter, trace);
+		// The late angle arrives while the coroutine waits for the ping.
+		unsigned long start = millis();
+		while (trace.count == 0 && millis() - start < 1000)
+		{
+			bus.run(servo, 1);
+		}
+		CHECK(trace.count == 1);
+		CHECK(trace.status[0] == AWAIT_TIMEOUT);
+		bus.run(servo, 1);
+		script.number = 0;
+		script.otherNumber = 0;
+		bus.release();
+		finish(bus, servo, routine);
+		CHECK(routine.isDone());
+	}
+	CHECK(trace.count == 2);
+	CHECK(trace.status[1] == AWAIT_OK);
+	CHECK(trace.value[1] == 1);
+	CHECK(pool.getFree() == 2);
+}
+
+// A coroutine destroyed while it waits frees its frame once resumed, a broadcast resumes at once.
+static void testDetach()
+{
+	Script script = { PACKET_READ_ANGLE, 0, REPLY_DROP };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ServoBus awaiter(servo);
+	StaticCoroutinePool<1024, 2> pool;
+	Trace trace = {};
+
+	{
+		ServoRoutine routine = readTwice(pool, awaiter, trace);
+		CHECK(pool.getFree() == 1);
+	}
+	bus.run(servo, 50);
+	CHECK(trace.count == 2);
+	CHECK(pool.getFree() == 2);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+
+	trace.count = 0;
+	{
+		ServoRoutine routine = dampAll(pool, awaiter, trace);
+		CHECK(routine.isDone());
+	}
+	CHECK(trace.count == 1);
+	CHECK(trace.status[0] == AWAIT_OK);
+	CHECK(pool.getFree() == 2);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testDetach();
+	return reportTest("servo coroutine");
+}
@@ -0,0 +1,161 @@
+// ServoSnapshotTest.cpp
+//
+// Loopback test of ServoSnapshot: lost responses, late responses, and clear() with reads in flight.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -Isrc/UARTServo -Iextras/tests extras/tests/ServoSnapshotTest.cpp src/UARTServo/*.cpp -o servo-snapshot-test
+// Run:
+//   ./servo-snapshot-test
+
+#include "LoopbackTest.h"
+#include "ServoSnapshot.h"
+
+/// Swept servos.
+#define FIRST_SERVO		1
+#define SECOND_SERVO	2
+
+struct Script
+{
+	/// Servo whose status responses are lost or held, ALL_SERVOS for every response of every servo.
+	byte id;
+	/// Lost or held.
+	ScriptAction action;
+	/// Number of responses still to lose or hold, negative for no limit.
+	int times;
+};
+
+static ScriptAction answer(byte number, const byte* payload, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	bool status = number == PACKET_READ_DATA && payload[1] == (byte)DataId::Status && payload[0] == script->id;
+	if (script->times == 0 || (!status && script->id != ALL_SERVOS))
+	{
+		return REPLY_NOW;
+	}
+	if (script->times > 0)
+	{
+		script->times--;
+	}
+	return script->action;
+}
+
+/// Run until a sweep is published, or for a second at most.
+static void nextSweep(ScriptedServo& bus, UARTServo& servo, const ServoSnapshot& snapshot)
+{
+	unsigned long sweep = snapshot.getSweep();
+	unsigned long start = millis();
+	while (snapshot.getSweep() == sweep && millis() - start < 1000)
+	{
+		servo.update();
+		bus.update();
+	}
+}
+
+// A lost status read is missing from the snapshot, the other servo and the angles are not disturbed.
+static void testLostResponse()
+{
+	Script script = { FIRST_SERVO, REPLY_DROP, -1 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(5);
+	ServoSnapshot snapshot;
+	servo.attach(&snapshot);
+	snapshot.setPeriod(100);
+	snapshot.add(FIRST_SERVO);
+	snapshot.add(SECOND_SERVO);
+
+	nextSweep(bus, servo, snapshot);
+	StateSnapshot state;
+	CHECK(snapshot.read(&state));
+	CHECK(state.count == 2);
+	CHECK(state.servos[0].fresh == (1 << SNAPSHOT_ANGLE));
+	CHECK(state.servos[1].fresh == ((1 << SNAPSHOT_ANGLE) | (1 << SNAPSHOT_STATUS)));
+	CHECK(state.servos[0].times[SNAPSHOT_STATUS] == 0);
+	// The timeout ended the sweep before its period.
+	CHECK(snapshot.getOverruns() == 0);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	servo.detach(&snapshot);
+}
+
+// A read still waiting at the end of the period is cancelled and counted as an overrun, its late response changes nothing.
+static void testLateResponse()
+{
+	Script script = { FIRST_SERVO, REPLY_HOLD, 1 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(0);
+	ServoSnapshot snapshot;
+	servo.attach(&snapshot);
+	snapshot.setPeriod(20);
+	snapshot.add(FIRST_SERVO);
+	snapshot.add(SECOND_SERVO);
+
+	nextSweep(bus, servo, snapshot);
+	StateSnapshot state;
+	CHECK(snapshot.read(&state));
+	CHECK(snapshot.getOverruns() == 1);
+	CHECK((state.servos[0].fresh & (1 << SNAPSHOT_STATUS)) == 0);
+	CHECK((state.servos[1].fresh & (1 << SNAPSHOT_STATUS)) != 0);
+
+	// The next sweep is whole, the late response arrives after it.
+	nextSweep(bus, servo, snapshot);
+	bus.release();
+	servo.update();
+	unsigned long sweep = snapshot.getSweep();
+	CHECK(snapshot.read(&state));
+	CHECK(state.servos[0].fresh == ((1 << SNAPSHOT_ANGLE) | (1 << SNAPSHOT_STATUS)));
+	CHECK(snapshot.getOverruns() == 1);
+
+	nextSweep(bus, servo, snapshot);
+	CHECK(snapshot.getSweep() == sweep + 1);
+	CHECK(snapshot.getOverruns() == 1);
+	servo.detach(&snapshot);
+}
+
+// clear() stops the sweeps, the reads in flight are cancelled at the end of the period.
+static void testClear()
+{
+	Script script = { ALL_SERVOS, REPLY_HOLD, -1 };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(0);
+	ServoSnapshot snapshot;
+	servo.attach(&snapshot);
+	snapshot.setPeriod(20);
+	snapshot.add(FIRST_SERVO);
+	snapshot.add(SECOND_SERVO);
+
+	// The angle and status of both servos.
+	bus.run(servo, 5);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS - 4);
+	snapshot.clear();
+	bus.run(servo, 30);
+	CHECK(snapshot.getSweep() == 1);
+	CHECK(snapshot.getOverruns() == 1);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	CHECK(snapshot.getPollDelay(millis()) == POLL_IDLE);
+
+	script.times = 0;
+	bus.release();
+	bus.run(servo, 30);
+	CHECK(snapshot.getSweep() == 1);
+	StateSnapshot state;
+	CHECK(snapshot.read(&state));
+	CHECK(state.servos[0].fresh == 0);
+	CHECK(state.servos[1].fresh == 0);
+	servo.detach(&snapshot);
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testClear();
+	return reportTest("servo snapshot");
+}
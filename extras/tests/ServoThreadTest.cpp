@@ -0,0 +1,176 @@
+// ServoThreadTest.cpp
+//
+// Loopback test of ServoThread over a pseudo terminal: lost responses, late responses, and stop() with commands in flight.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -pthread -Isrc/UARTServo -Iextras/tests extras/tests/ServoThreadTest.cpp src/UARTServo/*.cpp -o servo-thread-test
+// Run:
+//   ./servo-thread-test
+
+#include "LoopbackTest.h"
+#include "PtyTransport.h"
+#include "ServoThread.h"
+
+struct Script
+{
+	/// Packet number whose responses are lost or held, zero for none and ALL_SERVOS for all.
+	byte number;
+	/// Lost or held.
+	ScriptAction action;
+};
+
+static ScriptAction answer(byte number, const byte*, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	return (number == script->number || script->number == ALL_SERVOS) ? script->action : REPLY_NOW;
+}
+
+/*!
+ * Answer the bus thread until a number of responses has been received, or for a second at most.
+ *
+ * \param responses Received responses, in order.
+ * \return Number of responses received.
+ */
+static int collect(ScriptedServo& bus, ServoThread& thread, ThreadResponse* responses, int count)
+{
+	int received = 0;
+	unsigned long start = millis();
+	while (received < count && millis() - start < 1000)
+	{
+		bus.update();
+		while (received < count && thread.receive(&responses[received]))
+		{
+			received++;
+		}
+	}
+	return received;
+}
+
+/// The pseudo terminal between the test, as the servo, and the UARTServo object on the bus thread.
+struct Bench
+{
+	PtyTransport master;
+	TermiosTransport* slave;
+	UARTServo servo;
+
+	Bench() : slave(NULL) {}
+
+	bool begin()
+	{
+		if (!master.begin(115200))
+		{
+			return false;
+		}
+		slave = new TermiosTransport(master.getSlaveName());
+		servo.begin(slave, 115200);
+		servo.setTimeout(10);
+		return true;
+	}
+
+	~Bench()
+	{
+		delete slave;
+	}
+};
+
+// A lost response is reported as THREAD_TIMEOUT, the next command goes on normally.
+static void testLostResponse()
+{
+	Bench bench;
+	CHECK(bench.begin());
+	Script script = { PACKET_READ_ANGLE, REPLY_DROP };
+	ScriptedServo bus(&bench.master);
+	bus.setScript(answer, &script);
+	ServoThread thread(bench.servo);
+	CHECK(thread.start());
+
+	ThreadResponse responses[2];
+	thread.readAngle(1, 10);
+	thread.ping(1, 11);
+	CHECK(collect(bus, thread, responses, 2) == 2);
+	// The ping is answered while the angle waits for its timeout.
+	CHECK(responses[0].kind == THREAD_RESPONSE && responses[0].tag == 11);
+	CHECK(responses[1].kind == THREAD_TIMEOUT && responses[1].tag == 10);
+	thread.stop();
+	CHECK(bench.servo.getFreeRequestSlots() == PENDING_REQUESTS);
+}
+
+// A response arriving after its timeout is not reported.
+static void testLateResponse()
+{
+	Bench bench;
+	CHECK(bench.begin());
+	Script script = { PACKET_READ_ANGLE, REPLY_HOLD };
+	ScriptedServo bus(&bench.master);
+	bus.setScript(answer, &script);
+	ServoThread thread(bench.servo);
+	CHECK(thread.start());
+
+	ThreadResponse responses[2];
+	thread.readAngle(1, 10);
+	CHECK(collect(bus, thread, responses, 1) == 1);
+	CHECK(responses[0].kind == THREAD_TIMEOUT && responses[0].tag == 10);
+
+	script.number = 0;
+	bus.release();
+	thread.ping(1, 11);
+	CHECK(collect(bus, thread, responses, 2) == 1);
+	CHECK(responses[0].kind == THREAD_RESPONSE && responses[0].tag == 11);
+	CHECK(responses[0].number == PACKET_PING);
+	thread.stop();
+	CHECK(bench.servo.getFreeRequestSlots() == PENDING_REQUESTS);
+}
+
+// stop() reports the commands in flight as cancelled and the held one as not sent, their late responses reach no one.
+static void testStop()
+{
+	Bench bench;
+	CHECK(bench.begin());
+	Script script = { ALL_SERVOS, REPLY_HOLD };
+	ScriptedServo bus(&bench.master);
+	bus.setScript(answer, &script);
+	bench.servo.setTimeout(0);
+	ServoThread thread(bench.servo);
+	CHECK(thread.start());
+
+	for (unsigned long tag = 0; tag <= PENDING_REQUESTS; tag++)
+	{
+		thread.ping(1, tag);
+	}
+	unsigned long start = millis();
+	while (bus.getRequests() < PENDING_REQUESTS && millis() - start < 1000)
+	{
+		bus.update();
+	}
+	CHECK(bus.getRequests() == PENDING_REQUESTS);
+	thread.stop();
+
+	int cancelled = 0;
+	int notSent = 0;
+	ThreadResponse response;
+	while (thread.receive(&response))
+	{
+		cancelled += (response.kind == THREAD_CANCELLED) ? 1 : 0;
+		notSent += (response.kind == THREAD_NOT_SENT && response.tag == PENDING_REQUESTS) ? 1 : 0;
+	}
+	CHECK(cancelled == PENDING_REQUESTS);
+	CHECK(notSent == 1);
+	CHECK(bench.servo.getFreeRequestSlots() == PENDING_REQUESTS);
+
+	// The UARTServo object is the caller's again, the late responses find no request.
+	bus.release();
+	start = millis();
+	while (millis() - start < 20)
+	{
+		bench.servo.update();
+	}
+	CHECK(!thread.receive(&response));
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testStop();
+	return reportTest("servo thread");
+}
@@ -0,0 +1,130 @@
+// TelemetryTest.cpp
+//
+// Loopback test of ServoTelemetry: lost responses, late responses, and clear() with polls in flight.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -Isrc/UARTServo -Iextras/tests extras/tests/TelemetryTest.cpp src/UARTServo/*.cpp -o telemetry-test
+// Run:
+//   ./telemetry-test
+
+#include "LoopbackTest.h"
+#include "ServoTelemetry.h"
+
+/// Polled data IDs: voltage and current.
+#define VOLTAGE		1
+#define CURRENT		2
+
+struct Script
+{
+	/// Data ID whose responses are lost, zero for none.
+	byte drop;
+	/// Data ID whose responses are held back, zero for none.
+	byte hold;
+	/// Read data requests received, by data ID.
+	unsigned long requests[3];
+};
+
+static ScriptAction answer(byte number, const byte* payload, byte, byte*, byte*, void* context)
+{
+	Script* script = (Script*)context;
+	if (number != PACKET_READ_DATA || payload[1] > CURRENT)
+	{
+		return REPLY_NOW;
+	}
+	script->requests[payload[1]]++;
+	if (payload[1] == script->drop)
+	{
+		return REPLY_DROP;
+	}
+	return (payload[1] == script->hold || script->hold == ALL_SERVOS) ? REPLY_HOLD : REPLY_NOW;
+}
+
+// The field whose responses are lost is counted as missed and polled again, the other one is not disturbed.
+static void testLostResponse()
+{
+	Script script = { VOLTAGE, 0, { 0 } };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ServoTelemetry telemetry;
+	servo.attach(&telemetry);
+	int voltage = telemetry.add(1, VOLTAGE, 20);
+	int current = telemetry.add(1, CURRENT, 20);
+
+	bus.run(servo, 300);
+	CHECK(!telemetry.isValid(voltage));
+	CHECK(telemetry.getMissed(voltage) >= 5);
+	CHECK(script.requests[VOLTAGE] >= 5);
+	CHECK(telemetry.isValid(current));
+	CHECK(telemetry.getMissed(current) == 0);
+	servo.detach(&telemetry);
+}
+
+// A response arriving after its timeout is dropped, and the polls go on.
+static void testLateResponse()
+{
+	Script script = { 0, VOLTAGE, { 0 } };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(10);
+	ServoTelemetry telemetry;
+	servo.attach(&telemetry);
+	int voltage = telemetry.add(1, VOLTAGE, 20);
+	int current = telemetry.add(1, CURRENT, 20);
+
+	bus.run(servo, 100);
+	byte missed = telemetry.getMissed(voltage);
+	CHECK(missed >= 2);
+	CHECK(!telemetry.isValid(voltage));
+
+	script.hold = 0;
+	bus.release();
+	bus.run(servo, 100);
+	CHECK(telemetry.isValid(voltage));
+	CHECK(telemetry.getMissed(voltage) <= missed + 1);
+	CHECK(telemetry.getMissed(current) == 0);
+	servo.detach(&telemetry);
+}
+
+// clear() cancels the polls in flight, their responses do not reach the entries added next.
+static void testClear()
+{
+	Script script = { 0, ALL_SERVOS, { 0 } };
+	ScriptedServo bus;
+	bus.setScript(answer, &script);
+	UARTServo servo;
+	servo.begin(bus.getTransport());
+	servo.setTimeout(0);
+	ServoTelemetry telemetry;
+	servo.attach(&telemetry);
+	telemetry.add(1, VOLTAGE, 20);
+	telemetry.add(1, CURRENT, 20);
+
+	bus.run(servo, 5);
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS - 2);
+	telemetry.clear();
+	CHECK(servo.getFreeRequestSlots() == PENDING_REQUESTS);
+	CHECK(telemetry.getCount() == 0);
+
+	script.hold = 0;
+	bus.release();
+	servo.update();
+	int current = telemetry.add(1, CURRENT, 20);
+	CHECK(!telemetry.isValid(current));
+	bus.run(servo, 50);
+	CHECK(telemetry.isValid(current));
+	CHECK(telemetry.getMissed(current) == 0);
+	servo.detach(&telemetry);
+}
+
+int main()
+{
+	testLostResponse();
+	testLateResponse();
+	testClear();
+	return reportTest("telemetry");
+}
@@ -0,0 +1,285 @@
+#include "BaudRateUpgrade.h"
+
+/// Data ID of the baud rate index.
+#define BAUD_INDEX_DATA_ID		36
+
+BaudRateUpgrade::BaudRateUpgrade()
+	: _state(IDLE), _result(UPGRADE_RUNNING), _newIndex(0), _oldIndex(0), _firstID(0), _lastID(0), _cursor(0),
+	_inFlight(0), _maxInFlight(4), _settleTime(UPGRADE_SETTLE_TIME), _due(0), _settleRate(0), _afterSettle(IDLE), _callback(NULL)
+{
+	memset(_found, 0, sizeof(_found));
+	memset(_verified, 0, sizeof(_verified));
+}
+
+bool BaudRateUpgrade::start(UARTServo& servo, byte baudIndex, byte firstID, byte lastID, void(*callback)(byte))
+{
+	if (_state != IDLE || UARTServo::getBaudRate(baudIndex) == 0)
+	{
+		return false;
+	}
+	// The index of the current rate is needed to roll back.
+	_oldIndex = 0;
+	for (byte i = 1; UARTServo::getBaudRate(i) != 0; i++)
+	{
+		if (UARTServo::getBaudRate(i) == servo.getBaudRate())
+		{
+			_oldIndex = i;
+		}
+	}
+	if (_oldIndex == 0)
+	{
+		return false;
+	}
+	_newIndex = baudIndex;
+	_firstID = firstID;
+	_lastID = lastID;
+	_callback = callback;
+	_result = UPGRADE_RUNNING;
+	memset(_found, 0, sizeof(_found));
+	enter(DISCOVER);
+	return true;
+}
+
+void BaudRateUpgrade::setMaxInFlight(byte count)
+{
+	_maxInFlight = count;
+}
+
+void BaudRateUpgrade::setSettleTime(unsigned long settleTime)
+{
+	_settleTime = settleTime;
+}
+
+byte BaudRateUpgrade::getResult() const
+{
+	return _result;
+}
+
+bool BaudRateUpgrade::isFound(byte id) const
+{
+	return test(_found, id);
+}
+
+bool BaudRateUpgrade::isVerified(byte id) const
+{
+	return test(_verified, id);
+}
+
+void BaudRateUpgrade::poll(UARTServo& servo, unsigned long now)
+{
+	if (_state == IDLE)
+	{
+		return;
+	}
+	if (_state == SETTLE)
+	{
+		if ((long)(now - _due) >= 0)
+		{
+			servo.setBaudRate(_settleRate);
+			enter(_afterSettle);
+		}
+		return;
+	}
+
+	while (_inFlight < _maxInFlight && _cursor <= _lastID)
+	{
+		byte id = (byte)_cursor;
+		// Discovery sweeps the whole range, the other phases the servos found.
+		bool selected = (_state == DISCOVER) || (_state == ROLLBACK_WRITE ? test(_verified, id) : test(_found, id));
+		if (selected)
+		{
+			if (!send(servo, id))
+			{
+				// The pending-request table is full, try again in the next update.
+				break;
+			}
+			_inFlight++;
+		}
+		_cursor++;
+	}
+	if (_cursor > _lastID && _inFlight == 0)
+	{
+		finishPhase(servo, now);
+	}
+}
+
+unsigned long BaudRateUpgrade::getPollDelay(unsigned long now) const
+{
+	if (_state == IDLE)
+	{
+		return POLL_IDLE;
+	}
+	if (_state == SETTLE)
+	{
+		long left = (long)(_due - now);
+		return (left > 0) ? left : 0;
+	}
+	if ((_cursor <= _lastID && _inFlight < _maxInFlight) || (_cursor > _lastID && _inFlight == 0))
+	{
+		// A request to send, or the end of the phase.
+		return 0;
+	}
+	// Only a response or a timeout moves the phase on.
+	return POLL_IDLE;
+}
+
+void BaudRateUpgrade::onResponse(byte id, byte number, const byte*, byte)
+{
+	if (_inFlight > 0)
+	{
+		_inFlight--;
+	}
+	if (number != PACKET_PING)
+	{
+		return;
+	}
+	if (_state == DISCOVER)
+	{
+		set(_found, id);
+	}
+	else if (_state == VERIFY || _state == ROLLBACK_VERIFY)
+	{
+		set(_verified, id);
+	}
+}
+
+void BaudRateUpgrade::onTimeout(byte, byte, byte)
+{
+	if (_inFlight > 0)
+	{
+		_inFlight--;
+	}
+}
+
+void BaudRateUpgrade::enter(byte state)
+{
+	_state = state;
+	_cursor = _firstID;
+	_inFlight = 0;
+	if (state == VERIFY || state == ROLLBACK_VERIFY)
+	{
+		memset(_verified, 0, sizeof(_verified));
+	}
+}
+
+void BaudRateUpgrade::settle(unsigned long baud, byte state, unsigned long now)
+{
+	_settleRate = baud;
+	_afterSettle = state;
+	_due = now + _settleTime;
+	_state = SETTLE;
+}
+
+void BaudRateUpgrade::finish(byte result)
+{
+	_state = IDLE;
+	_result = result;
+	if (_callback != NULL)
+	{
+		_callback(result);
+	}
+}
+
+void BaudRateUpgrade::finishPhase(UARTServo&, unsigned long now)
+{
+	switch (_state)
+	{
+		case DISCOVER:
+		{
+			bool any = false;
+			for (byte i = 0; i < sizeof(_found); i++)
+			{
+				any = any || _found[i] != 0;
+			}
+			if (!any)
+			{
+				finish(UPGRADE_NO_SERVOS);
+			}
+			else
+			{
+				enter(WRITE);
+			}
+			break;
+		}
+		case WRITE:
+		{
+			// A write may be applied even if its reply is lost, so every servo found is verified.
+			settle(UARTServo::getBaudRate(_newIndex), VERIFY, now);
+			break;
+		}
+		case VERIFY:
+		{
+			if (allVerified())
+			{
+				finish(UPGRADE_SUCCESS);
+			}
+			else if (anyVerified())
+			{
+				enter(ROLLBACK_WRITE);
+			}
+			else
+			{
+				settle(UARTServo::getBaudRate(_oldIndex), ROLLBACK_VERIFY, now);
+			}
+			break;
+		}
+		case ROLLBACK_WRITE:
+		{
+			settle(UARTServo::getBaudRate(_oldIndex), ROLLBACK_VERIFY, now);
+			break;
+		}
+		case ROLLBACK_VERIFY:
+		{
+			finish(allVerified() ? UPGRADE_ROLLED_BACK : UPGRADE_FAILED);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+bool BaudRateUpgrade::send(UARTServo& servo, byte id)
+{
+	if (_state == WRITE || _state == ROLLBACK_WRITE)
+	{
+		byte payload[3] = { id, BAUD_INDEX_DATA_ID, (_state == WRITE) ? _newIndex : _oldIndex };
+		return servo.sendRequest(PACKET_WRITE_DATA, payload, sizeof(payload), this);
+	}
+	return servo.sendRequest(PACKET_PING, &id, 1, this);
+}
+
+bool BaudRateUpgrade::allVerified() const
+{
+	for (byte i = 0; i < sizeof(_found); i++)
+	{
+		if ((_found[i] & ~_verified[i]) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BaudRateUpgrade::anyVerified() const
+{
+	for (byte i = 0; i < sizeof(_verified); i++)
+	{
+		if (_verified[i] != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool BaudRateUpgrade::test(const byte* bits, byte id)
+{
+	return (bits[id >> 3] & (1 << (id & 0x07))) != 0;
+}
+
+void BaudRateUpgrade::set(byte* bits, byte id)
+{
+	bits[id >> 3] |= (byte)(1 << (id & 0x07));
+}
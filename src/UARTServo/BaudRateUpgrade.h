@@ -0,0 +1,116 @@
+// BaudRateUpgrade.h
+
+#ifndef BAUDRATEUPGRADE_H
+#define BAUDRATEUPGRADE_H
+
+#include "UARTServo.h"
+
+/// Upgrade result: still running.
+#define UPGRADE_RUNNING			0
+/// Upgrade result: every servo answers at the new connecting rate.
+#define UPGRADE_SUCCESS			1
+/// Upgrade result: some servos did not switch, every servo is back at the old connecting rate.
+#define UPGRADE_ROLLED_BACK		2
+/// Upgrade result: some servos answer neither at the new nor at the old connecting rate.
+#define UPGRADE_FAILED			3
+/// Upgrade result: no servo has been found.
+#define UPGRADE_NO_SERVOS		4
+
+/// Default time the servos get to switch their connecting rate(unit: millisecond).
+#define UPGRADE_SETTLE_TIME		50
+
+/*!
+ * BaudRateUpgrade class
+ * Moves every servo of a bus to another connecting rate:
+ * it pings the IDs of a range to discover the servos, writes the new baud rate index (data ID 36) to each one,
+ * reopens the transport at the new rate and pings each servo again.
+ * If a servo does not answer at the new rate, the whole bus is rolled back: the servos that switched get the old index,
+ * the transport is reopened at the old rate and each servo is pinged once more, so no servo is left stranded.
+ *
+ * Attach it to a UARTServo object and call start(), the procedure runs from UARTServo::update().
+ * It relies on the request timeout of the UARTServo object, which must not be zero.
+ */
+class BaudRateUpgrade : public UARTServoTask, public ResponseHandler
+{
+public:
+	BaudRateUpgrade();
+
+	/*!
+	 * Start the upgrade.
+	 *
+	 * \param baudIndex New baud rate index, see UserParameter::baudIndex.
+	 * \param firstID First servo ID to discover.
+	 * \param lastID Last servo ID to discover.
+	 * \param callback Function called when the upgrade is finished, NULL for none. The parameter is the result(byte; see UPGRADE_SUCCESS, ...).
+	 * \return false if the index is unknown, the current rate has no index, or an upgrade is running.
+	 */
+	bool start(UARTServo& servo, byte baudIndex, byte firstID = 0, byte lastID = 0xfd, void(*callback)(byte) = NULL);
+
+	/*!
+	 * Limit the number of requests waiting for their responses, default value is 4.
+	 */
+	void setMaxInFlight(byte count);
+
+	/*!
+	 * Set the time the servos get to switch their connecting rate, default value is UPGRADE_SETTLE_TIME.
+	 *
+	 * \param settleTime Time(unit: millisecond).
+	 */
+	void setSettleTime(unsigned long settleTime);
+
+	/// Result of the last upgrade, UPGRADE_RUNNING while it runs.
+	byte getResult() const;
+
+	/// Whether a servo has been discovered.
+	bool isFound(byte id) const;
+
+	/// Whether a servo has answered at the final connecting rate.
+	bool isVerified(byte id) const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+	void onResponse(byte id, byte number, const byte* payload, byte length);
+	void onTimeout(byte id, byte number, byte argument);
+
+private:
+	enum State
+	{
+		IDLE,
+		DISCOVER,
+		WRITE,
+		VERIFY,
+		ROLLBACK_WRITE,
+		ROLLBACK_VERIFY,
+		SETTLE
+	};
+
+	byte _state;
+	byte _result;
+	byte _newIndex;
+	byte _oldIndex;
+	byte _firstID;
+	byte _lastID;
+	unsigned int _cursor;
+	byte _inFlight;
+	byte _maxInFlight;
+	unsigned long _settleTime;
+	unsigned long _due;
+	unsigned long _settleRate;
+	byte _afterSettle;
+	void(*_callback)(byte);
+	byte _found[32];
+	byte _verified[32];
+
+	void enter(byte state);
+	void settle(unsigned long baud, byte state, unsigned long now);
+	void finish(byte result);
+	void finishPhase(UARTServo& servo, unsigned long now);
+	bool send(UARTServo& servo, byte id);
+	bool allVerified() const;
+	bool anyVerified() const;
+
+	static bool test(const byte* bits, byte id);
+	static void set(byte* bits, byte id);
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "BusCapture.h"
+#include "UARTServo.h"
+
+BusCapture::BusCapture()
+	: _dropped(0)
+{
+}
+
+void BusCapture::record(byte direction, const byte* data, size_t size)
+{
+	if (_buffer.getCapacity() - _buffer.getLength() < CAPTURE_RECORD_HEADER + size)
+	{
+		_dropped++;
+		return;
+	}
+	_buffer.writeULong(micros());
+	_buffer.write(direction);
+	_buffer.writeUInt((unsigned int)size);
+	_buffer.write(data, size);
+}
+
+size_t BusCapture::read(byte* dest, size_t size)
+{
+	if (size > _buffer.getLength())
+	{
+		size = _buffer.getLength();
+	}
+	_buffer.read(dest, size);
+	return size;
+}
+
+unsigned int BusCapture::getLength()
+{
+	return _buffer.getLength();
+}
+
+unsigned long BusCapture::getDropped() const
+{
+	return _dropped;
+}
+
+#ifndef ARDUINO
+size_t BusCapture::drain(FILE* file)
+{
+	byte chunk[1024];
+	size_t total = 0;
+	size_t count;
+	while ((count = read(chunk, sizeof(chunk))) > 0)
+	{
+		total += fwrite(chunk, 1, count, file);
+	}
+	return total;
+}
+#endif
+
+BusReplay::BusReplay()
+	: _log(NULL), _size(0), _position(0), _started(false), _origin(0), _firstTimestamp(0),
+	_servo(NULL), _handler(NULL), _frameCallback(NULL), _txParser(REQUEST_HEADER), _rxParser(RESPONSE_HEADER)
+{
+}
+
+void BusReplay::begin(const byte* log, size_t size)
+{
+	_log = log;
+	_size = size;
+	_position = 0;
+	_started = false;
+	_txParser.reset();
+	_rxParser.reset();
+}
+
+void BusReplay::setTarget(UARTServo* servo, ResponseHandler* handler)
+{
+	_servo = servo;
+	_handler = handler;
+}
+
+void BusReplay::setFrameCallback(void(*callback)(unsigned long, byte, byte, const byte*, byte))
+{
+	_frameCallback = callback;
+}
+
+bool BusReplay::update(unsigned long now)
+{
+	while (!isFinished())
+	{
+		FrameReader reader(_log + _position, _size - _position);
+		unsigned long timestamp = reader.readULong();
+		if (!_started)
+		{
+			_started = true;
+			_origin = now;
+			_firstTimestamp = timestamp;
+		}
+		// Stamps are 32 bits wide, so both spans are taken modulo 2^32 to survive the wrap of micros().
+		uint32_t elapsed = (uint32_t)(now - _origin);
+		uint32_t offset = (uint32_t)(timestamp - _firstTimestamp);
+		if ((int32_t)(elapsed - offset) < 0)
+		{
+			return true;
+		}
+		play();
+	}
+	return false;
+}
+
+size_t BusReplay::run()
+{
+	size_t total = 0;
+	while (!isFinished())
+	{
+		total += play();
+	}
+	return total;
+}
+
+bool BusReplay::isFinished() const
+{
+	return _position + CAPTURE_RECORD_HEADER > _size;
+}
+
+size_t BusReplay::play()
+{
+	FrameReader reader(_log + _position, _size - _position);
+	unsigned long timestamp = reader.readULong();
+	byte direction = reader.read();
+	size_t length = reader.readUInt();
+	if (length > reader.getRemaining())
+	{
+		// Truncated record, the log ends here.
+		_position = _size;
+		return 0;
+	}
+	const byte* data = reader.getData();
+	_position += CAPTURE_RECORD_HEADER + length;
+
+	if (direction == CAPTURE_RX && _servo != NULL)
+	{
+		_servo->feed(data, length);
+	}
+	bool request = direction == CAPTURE_TX && _servo != NULL && _handler != NULL;
+	if (_frameCallback != NULL || request)
+	{
+		FrameParser& parser = (direction == CAPTURE_TX) ? _txParser : _rxParser;
+		size_t i = 0;
+		while (i < length)
+		{
+			i += parser.parse(data + i, length - i);
+			if (!parser.isComplete())
+			{
+				continue;
+			}
+			if (request && parser.getLength() > 0)
+			{
+				// Register the request, so that its response is matched when it is fed.
+				_servo->sendRequest(parser.getNumber(), parser.getPayload(), parser.getLength(), _handler);
+			}
+			if (_frameCallback != NULL)
+			{
+				_frameCallback(timestamp, direction, parser.getNumber(), parser.getPayload(), parser.getLength());
+			}
+		}
+	}
+	return length;
+}
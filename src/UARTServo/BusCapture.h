@@ -0,0 +1,159 @@
+// BusCapture.h
+
+#ifndef BUSCAPTURE_H
+#define BUSCAPTURE_H
+
+#include "Platform.h"
+#include "ByteBuffer.h"
+#include "FrameParser.h"
+
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+
+/// Size of the capture ring, a power of two.
+#ifndef CAPTURE_BUFFER_SIZE
+#ifdef ARDUINO
+#define CAPTURE_BUFFER_SIZE		256
+#else
+#define CAPTURE_BUFFER_SIZE		65536
+#endif
+#endif
+
+/// Capture direction: bytes sent to the servos.
+#define CAPTURE_TX				0x00
+/// Capture direction: bytes received from the servos.
+#define CAPTURE_RX				0x01
+
+/// Size of the record header: timestamp(4 bytes), direction(1 byte) and length(2 bytes).
+#define CAPTURE_RECORD_HEADER	7
+
+class UARTServo;
+class ResponseHandler;
+
+/*!
+ * BusCapture class
+ * Records the raw bytes going over the bus with their monotonic timestamps(unit: micro second).
+ * Records are appended to a preallocated ring, which costs a copy and never waits,
+ * so capturing does not disturb the bus timing. Drain the ring to storage outside the control path.
+ *
+ * The log is a sequence of records, all fields little-endian:
+ * timestamp(uint32), direction(CAPTURE_TX or CAPTURE_RX), length(uint16), then length bytes.
+ * \sa UARTServo::setCapture, BusReplay
+ */
+class BusCapture
+{
+public:
+	BusCapture();
+
+	/*!
+	 * Append a record, it is dropped if the ring has no room for it.
+	 *
+	 * \param direction CAPTURE_TX or CAPTURE_RX.
+	 * \param data Raw bytes.
+	 * \param size Number of bytes.
+	 */
+	void record(byte direction, const byte* data, size_t size);
+
+	/*!
+	 * Take log bytes out of the ring.
+	 *
+	 * \return Number of bytes copied.
+	 */
+	size_t read(byte* dest, size_t size);
+
+	/// Number of log bytes in the ring.
+	unsigned int getLength();
+
+	/// Number of records dropped because the ring was full.
+	unsigned long getDropped() const;
+
+#ifndef ARDUINO
+	/*!
+	 * Write the log bytes of the ring to a file.
+	 *
+	 * \return Number of bytes written.
+	 */
+	size_t drain(FILE* file);
+#endif
+
+private:
+	ByteBuffer<CAPTURE_BUFFER_SIZE> _buffer;
+	unsigned long _dropped;
+};
+
+/*!
+ * BusReplay class
+ * Plays a capture back: received bytes are fed to a UARTServo object, and the frames of both directions
+ * can be reported to a callback. Play at the recorded pace to reproduce timing, or at maximum speed
+ * to measure parser throughput.
+ *
+ * By default only the parser is replayed: the target has no pending requests, so it drops every response as unexpected.
+ * Give setTarget() a response handler to replay the requests as well, the responses then reach the handler.
+ */
+class BusReplay
+{
+public:
+	BusReplay();
+
+	/*!
+	 * Start playing a log held in memory.
+	 *
+	 * \param log Log bytes, they must stay valid while playing.
+	 * \param size Log size.
+	 */
+	void begin(const byte* log, size_t size);
+
+	/*!
+	 * Feed received bytes to this object, NULL for none.
+	 *
+	 * \param servo The target.
+	 * \param handler Handler of the replayed requests, NULL to replay the parser only.
+	 * Each request of the log is sent by UARTServo::sendRequest() before its responses are fed, so the target
+	 * writes it to its transport again: begin the target with one going nowhere, e.g. an unconnected LoopbackTransport.
+	 */
+	void setTarget(UARTServo* servo, ResponseHandler* handler = NULL);
+
+	/*!
+	 * Set the function called for every complete frame.
+	 *
+	 * \param callback Callback function. The parameters in order are timestamp(unsigned long; unit: micro second),
+	 * direction(byte; CAPTURE_TX or CAPTURE_RX), packet number(byte), payload(const byte*), and payload length(byte).
+	 */
+	void setFrameCallback(void(*callback)(unsigned long, byte, byte, const byte*, byte));
+
+	/*!
+	 * Play the records that are due, at the recorded pace from the first call.
+	 *
+	 * \param now Current time(unit: micro second).
+	 * \return false when the whole log has been played.
+	 */
+	bool update(unsigned long now);
+
+	/*!
+	 * Play the whole log at maximum speed.
+	 *
+	 * \return Number of bytes fed.
+	 */
+	size_t run();
+
+	/// Whether the whole log has been played.
+	bool isFinished() const;
+
+private:
+	const byte* _log;
+	size_t _size;
+	size_t _position;
+	bool _started;
+	unsigned long _origin;
+	unsigned long _firstTimestamp;
+	UARTServo* _servo;
+	ResponseHandler* _handler;
+	void(*_frameCallback)(unsigned long, byte, byte, const byte*, byte);
+	FrameParser _txParser;
+	FrameParser _rxParser;
+
+	size_t play();
+};
+
+#endif
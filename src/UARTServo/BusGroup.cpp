@@ -0,0 +1,166 @@
+#include "BusGroup.h"
+
+BusGroup::BusGroup()
+	: _busCount(0)
+{
+	clearMap();
+}
+
+int BusGroup::addBus(UARTTransport* transport, unsigned long baud)
+{
+	if (_busCount >= GROUP_BUSES || !_buses[_busCount].begin(transport, baud))
+	{
+		return -1;
+	}
+	return _busCount++;
+}
+
+byte BusGroup::getBusCount() const
+{
+	return _busCount;
+}
+
+UARTServo& BusGroup::getBus(byte bus)
+{
+	return _buses[bus];
+}
+
+bool BusGroup::map(byte address, byte bus, byte id)
+{
+	if (address >= GROUP_SERVOS || bus >= _busCount)
+	{
+		return false;
+	}
+	_addressBuses[address] = bus;
+	_addressIDs[address] = id;
+	return true;
+}
+
+void BusGroup::clearMap()
+{
+	for (byte i = 0; i < GROUP_SERVOS; i++)
+	{
+		_addressBuses[i] = GROUP_BUSES;
+	}
+}
+
+UARTServo* BusGroup::locate(byte address, byte* id)
+{
+	if (address >= GROUP_SERVOS || _addressBuses[address] == GROUP_BUSES)
+	{
+		return NULL;
+	}
+	*id = _addressIDs[address];
+	return &_buses[_addressBuses[address]];
+}
+
+int BusGroup::getAddress(byte bus, byte id) const
+{
+	for (byte i = 0; i < GROUP_SERVOS; i++)
+	{
+		if (_addressBuses[i] == bus && _addressIDs[i] == id)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void BusGroup::update()
+{
+	// Transports never block, so one pass serves every bus without waiting on any of them.
+	for (byte i = 0; i < _busCount; i++)
+	{
+		_buses[i].update();
+	}
+}
+
+long BusGroup::getPollTimeout() const
+{
+	long timeout = -1;
+	for (byte i = 0; i < _busCount; i++)
+	{
+		long busTimeout = _buses[i].getPollTimeout();
+		if (busTimeout >= 0 && (timeout < 0 || busTimeout < timeout))
+		{
+			timeout = busTimeout;
+		}
+	}
+	return timeout;
+}
+
+#ifndef ARDUINO
+nfds_t BusGroup::getPollDescriptors(struct pollfd* fds) const
+{
+	nfds_t count = 0;
+	for (byte i = 0; i < _busCount; i++)
+	{
+		int fd = _buses[i].getFileDescriptor();
+		if (fd >= 0)
+		{
+			fds[count].fd = fd;
+			fds[count].events = POLLIN | (_buses[i].isWritePending() ? POLLOUT : 0);
+			fds[count].revents = 0;
+			count++;
+		}
+	}
+	return count;
+}
+#endif
+
+bool BusGroup::rotateGroup(const ServoMotion* motions, byte count, byte number, bool broadcast)
+{
+	bool result = true;
+	for (byte i = 0; i < count; i++)
+	{
+		if (motions[i].id >= GROUP_SERVOS || _addressBuses[motions[i].id] == GROUP_BUSES)
+		{
+			result = false;
+		}
+	}
+	ServoMotion local[GROUP_SERVOS];
+	for (byte bus = 0; bus < _busCount; bus++)
+	{
+		byte localCount = 0;
+		for (byte i = 0; i < count && localCount < GROUP_SERVOS; i++)
+		{
+			byte address = motions[i].id;
+			if (address < GROUP_SERVOS && _addressBuses[address] == bus)
+			{
+				local[localCount] = motions[i];
+				local[localCount].id = _addressIDs[address];
+				localCount++;
+			}
+		}
+		if (localCount > 0)
+		{
+			// A broadcast would also move the servos of the bus left out of the group.
+			if (!_buses[bus].rotateGroup(local, localCount, number, broadcast && coversBus(motions, count, bus)))
+			{
+				result = false;
+			}
+		}
+	}
+	return result;
+}
+
+bool BusGroup::coversBus(const ServoMotion* motions, byte count, byte bus) const
+{
+	for (byte address = 0; address < GROUP_SERVOS; address++)
+	{
+		if (_addressBuses[address] != bus)
+		{
+			continue;
+		}
+		bool found = false;
+		for (byte i = 0; i < count && !found; i++)
+		{
+			found = motions[i].id == address;
+		}
+		if (!found)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,146 @@
+// BusGroup.h
+
+#ifndef BUSGROUP_H
+#define BUSGROUP_H
+
+#include "UARTServo.h"
+
+#ifndef ARDUINO
+#include <poll.h>
+#endif
+
+/// Maximum number of buses.
+#ifndef GROUP_BUSES
+#ifdef ARDUINO
+#define GROUP_BUSES				2
+#else
+#define GROUP_BUSES				4
+#endif
+#endif
+
+/// Number of global servo addresses.
+#ifndef GROUP_SERVOS
+#ifdef ARDUINO
+#define GROUP_SERVOS			16
+#else
+#define GROUP_SERVOS			64
+#endif
+#endif
+
+/*!
+ * BusGroup class
+ * Drives servos split across several buses, e.g. one USB-serial adapter per limb.
+ * Each bus is a UARTServo object over its own transport, and a global servo address maps to a (bus, servo ID) pair.
+ * update() services every bus in turn without blocking, so the buses carry their traffic in parallel
+ * and the throughput grows with the number of buses.
+ * A group motion is split by bus, and the frames of every bus are written in the same call.
+ */
+class BusGroup
+{
+public:
+	BusGroup();
+
+	/*!
+	 * Add a bus.
+	 *
+	 * \param transport A pointer to the transport, it must stay valid while this object is used.
+	 * \param baud Transmission rate, default value is BAUD_RATE.
+	 * \return Bus index, -1 if there is no room or the transport is not opened.
+	 */
+	int addBus(UARTTransport* transport, unsigned long baud = BAUD_RATE);
+
+	/// Number of buses.
+	byte getBusCount() const;
+
+	/*!
+	 * The UARTServo object of a bus, to set it up, attach tasks, or send commands by servo ID.
+	 *
+	 * \param bus Bus index.
+	 */
+	UARTServo& getBus(byte bus);
+
+	/*!
+	 * Map a global servo address to a servo on a bus.
+	 *
+	 * \param address Global servo address, less than GROUP_SERVOS.
+	 * \param bus Bus index.
+	 * \param id Servo ID on the bus.
+	 * \return false if the address or the bus is out of range.
+	 */
+	bool map(byte address, byte bus, byte id);
+
+	/*!
+	 * Remove all address mappings.
+	 */
+	void clearMap();
+
+	/*!
+	 * Find the bus of a global servo address.
+	 *
+	 * \param address Global servo address.
+	 * \param id The servo ID on the bus.
+	 * \return The UARTServo object of the bus, NULL if the address is not mapped.
+	 */
+	UARTServo* locate(byte address, byte* id);
+
+	/*!
+	 * Find the global address of a servo on a bus.
+	 *
+	 * \return Global servo address, -1 if the servo is not mapped.
+	 */
+	int getAddress(byte bus, byte id) const;
+
+	/*!
+	 * Update all buses.
+	 * It should be placed in function loop().
+	 */
+	void update();
+
+	/*!
+	 * Time until the next deadline of any bus, the timeout of poll(), see UARTServo::getPollTimeout().
+	 *
+	 * \return Timeout(unit: millisecond), -1 if every bus is idle.
+	 */
+	long getPollTimeout() const;
+
+#ifndef ARDUINO
+	/*!
+	 * Fill the entries of poll() for the buses with a file descriptor, e.g.
+	 *
+	 *     struct pollfd fds[GROUP_BUSES];
+	 *     poll(fds, group.getPollDescriptors(fds), group.getPollTimeout());
+	 *     group.update();
+	 *
+	 * A bus without one (e.g. LoopbackTransport) is only served when poll() returns, so the timeout should then be bounded.
+	 *
+	 * \param fds At least getBusCount() entries.
+	 * \return Number of entries filled.
+	 */
+	nfds_t getPollDescriptors(struct pollfd* fds) const;
+#endif
+
+	/*!
+	 * Rotate servos of all buses together, see UARTServo::rotateGroup().
+	 * ServoMotion::id holds the global servo address. The responses are not reported.
+	 *
+	 * \param motions Motions of the servos, unmapped addresses are skipped.
+	 * \param count Number of motions.
+	 * \param number PACKET_ROTATE, PACKET_ROTATE_BY_INTERVAL(default) or PACKET_ROTATE_BY_VELOCITY.
+	 * \param broadcast Whether a bus gets a single frame to ALL_SERVOS when the motions cover every servo mapped on it
+	 * and they all share one motion. Servos of the bus that are not mapped move as well then.
+	 * \return false if an address is not mapped, or a bus did not send its motions, see UARTServo::rotateGroup().
+	 */
+	bool rotateGroup(const ServoMotion* motions, byte count, byte number = PACKET_ROTATE_BY_INTERVAL, bool broadcast = false);
+
+private:
+	UARTServo _buses[GROUP_BUSES];
+	byte _busCount;
+	/// Bus index of each address, GROUP_BUSES if it is not mapped.
+	byte _addressBuses[GROUP_SERVOS];
+	byte _addressIDs[GROUP_SERVOS];
+
+	/// Whether the motions hold every address mapped on a bus.
+	bool coversBus(const ServoMotion* motions, byte count, byte bus) const;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include "BusScanner.h"
+
+/// Data ID of the model, the first identity field.
+#define MODEL_DATA_ID			6
+/// Data ID of the serial number, the last identity field.
+#define SERIAL_NUMBER_DATA_ID	8
+
+BusScanner::BusScanner()
+	: _running(false), _lastID(0), _cursor(0), _count(0), _maxInFlight(4), _turnaround(SCAN_TURNAROUND),
+	_pingTime(0), _readTime(0), _nextSend(0), _infoQueued(0), _infoID(ALL_SERVOS), _infoDataID(0), _infoInFlight(false),
+	_model(0), _firmwareVersion(0), _serialNumber(0), _foundCallback(NULL), _infoCallback(NULL), _finishCallback(NULL)
+{
+	memset(_found, 0, sizeof(_found));
+	for (byte i = 0; i < SCAN_IN_FLIGHT; i++)
+	{
+		_requests[i].number = 0;
+	}
+}
+
+bool BusScanner::start(const UARTServo& servo, byte firstID, byte lastID)
+{
+	if (_running)
+	{
+		return false;
+	}
+	// Time of one exchange: request, turnaround and reply.
+	_pingTime = servo.getWireTime(1 + FRAME_OVERHEAD) + _turnaround + servo.getWireTime(1 + FRAME_OVERHEAD);
+	_readTime = servo.getWireTime(2 + FRAME_OVERHEAD) + _turnaround + servo.getWireTime(6 + FRAME_OVERHEAD);
+	_running = true;
+	_lastID = lastID;
+	_cursor = firstID;
+	_count = 0;
+	memset(_found, 0, sizeof(_found));
+	_nextSend = micros();
+	_infoQueued = 0;
+	_infoID = ALL_SERVOS;
+	_infoInFlight = false;
+	return true;
+}
+
+void BusScanner::setFoundCallback(void(*callback)(byte))
+{
+	_foundCallback = callback;
+}
+
+void BusScanner::setInfoCallback(void(*callback)(byte, unsigned int, unsigned int, unsigned long))
+{
+	_infoCallback = callback;
+}
+
+void BusScanner::setFinishCallback(void(*callback)(byte))
+{
+	_finishCallback = callback;
+}
+
+void BusScanner::setMaxInFlight(byte count)
+{
+	_maxInFlight = (count < SCAN_IN_FLIGHT) ? count : SCAN_IN_FLIGHT;
+}
+
+void BusScanner::setTurnaround(unsigned long turnaround)
+{
+	_turnaround = turnaround;
+}
+
+bool BusScanner::isRunning() const
+{
+	return _running;
+}
+
+byte BusScanner::getCount() const
+{
+	return _count;
+}
+
+bool BusScanner::isFound(byte id) const
+{
+	return (_found[id >> 3] & (1 << (id & 0x07))) != 0;
+}
+
+void BusScanner::poll(UARTServo& servo, unsigned long)
+{
+	if (!_running)
+	{
+		return;
+	}
+	unsigned long time = micros();
+
+	for (byte i = 0; i < SCAN_IN_FLIGHT; i++)
+	{
+		Request* request = &_requests[i];
+		if (request->number != 0 && (long)(time - request->deadline) >= 0)
+		{
+			servo.cancelRequest(request->id, request->number, this);
+			if (request->number == PACKET_READ_DATA)
+			{
+				// The field stays zero.
+				nextInfo();
+			}
+			request->number = 0;
+		}
+	}
+
+	while ((long)(time - _nextSend) >= 0 && getInFlight() < _maxInFlight)
+	{
+		// Identity reads go first, so that the queue of servos found stays short.
+		if (hasInfoWork())
+		{
+			if (_infoID == ALL_SERVOS)
+			{
+				_infoID = _infoQueue[0];
+				_infoQueued--;
+				memmove(_infoQueue, _infoQueue + 1, _infoQueued);
+				_infoDataID = MODEL_DATA_ID;
+				_model = 0;
+				_firmwareVersion = 0;
+				_serialNumber = 0;
+			}
+			if (!send(servo, PACKET_READ_DATA, _infoID, _infoDataID, time))
+			{
+				break;
+			}
+			_infoInFlight = true;
+		}
+		else if (hasPingWork())
+		{
+			if (!send(servo, PACKET_PING, (byte)_cursor, 0, time))
+			{
+				break;
+			}
+			_cursor++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (_cursor > _lastID && getInFlight() == 0 && _infoID == ALL_SERVOS && _infoQueued == 0)
+	{
+		_running = false;
+		if (_finishCallback != NULL)
+		{
+			_finishCallback(_count);
+		}
+	}
+}
+
+unsigned long BusScanner::getPollDelay(unsigned long) const
+{
+	if (!_running)
+	{
+		return POLL_IDLE;
+	}
+	// Sends and deadlines are timed in microseconds, the delay is rounded up to the next millisecond.
+	unsigned long time = micros();
+	bool waiting = false;
+	long left = 0;
+	if ((hasInfoWork() || hasPingWork()) && getInFlight() < _maxInFlight)
+	{
+		left = (long)(_nextSend - time);
+		waiting = true;
+	}
+	for (byte i = 0; i < SCAN_IN_FLIGHT; i++)
+	{
+		long deadline = (long)(_requests[i].deadline - time);
+		if (_requests[i].number != 0 && (!waiting || deadline < left))
+		{
+			left = deadline;
+			waiting = true;
+		}
+	}
+	// With nothing to wait for, the scan is finished in the next poll.
+	return (waiting && left > 0) ? (left + 999) / 1000 : 0;
+}
+
+void BusScanner::onResponse(byte id, byte number, const byte* payload, byte length)
+{
+	Request* request = findRequest(id, number);
+	if (request == NULL)
+	{
+		return;
+	}
+	request->number = 0;
+
+	if (number == PACKET_PING)
+	{
+		if (isFound(id))
+		{
+			return;
+		}
+		_found[id >> 3] |= (byte)(1 << (id & 0x07));
+		_count++;
+		if (_foundCallback != NULL)
+		{
+			_foundCallback(id);
+		}
+		if (_infoCallback != NULL)
+		{
+			_infoQueue[_infoQueued++] = id;
+		}
+	}
+	else if (number == PACKET_READ_DATA && id == _infoID && length >= 2)
+	{
+		FrameReader reader(payload, length);
+		reader.read();
+		byte dataID = reader.read();
+		if (dataID == _infoDataID && reader.getRemaining() >= ((dataID == SERIAL_NUMBER_DATA_ID) ? 4 : 2))
+		{
+			switch (dataID)
+			{
+				case MODEL_DATA_ID:
+				{
+					_model = reader.readUInt();
+					break;
+				}
+				case SERIAL_NUMBER_DATA_ID:
+				{
+					_serialNumber = reader.readULong();
+					break;
+				}
+				default:
+				{
+					_firmwareVersion = reader.readUInt();
+					break;
+				}
+			}
+		}
+		nextInfo();
+	}
+}
+
+BusScanner::Request* BusScanner::findRequest(byte id, byte number)
+{
+	for (byte i = 0; i < SCAN_IN_FLIGHT; i++)
+	{
+		if (_requests[i].number == number && _requests[i].id == id)
+		{
+			return &_requests[i];
+		}
+	}
+	return NULL;
+}
+
+byte BusScanner::getInFlight() const
+{
+	byte count = 0;
+	for (byte i = 0; i < SCAN_IN_FLIGHT; i++)
+	{
+		if (_requests[i].number != 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+bool BusScanner::hasInfoWork() const
+{
+	return _infoCallback != NULL && !_infoInFlight && (_infoID != ALL_SERVOS || _infoQueued > 0);
+}
+
+bool BusScanner::hasPingWork() const
+{
+	return _cursor <= _lastID && _infoQueued < SCAN_IN_FLIGHT;
+}
+
+bool BusScanner::send(UARTServo& servo, byte number, byte id, byte dataID, unsigned long now)
+{
+	Request* request = NULL;
+	for (byte i = 0; i < SCAN_IN_FLIGHT && request == NULL; i++)
+	{
+		if (_requests[i].number == 0)
+		{
+			request = &_requests[i];
+		}
+	}
+	byte payload[2] = { id, dataID };
+	if (request == NULL || !servo.sendRequest(number, payload, (number == PACKET_PING) ? 1 : 2, this))
+	{
+		return false;
+	}
+	unsigned long exchange = (number == PACKET_PING) ? _pingTime : _readTime;
+	request->number = number;
+	request->id = id;
+	request->deadline = now + exchange + _turnaround;
+	_nextSend = now + exchange;
+	return true;
+}
+
+void BusScanner::nextInfo()
+{
+	_infoInFlight = false;
+	if (_infoDataID < SERIAL_NUMBER_DATA_ID)
+	{
+		_infoDataID++;
+		return;
+	}
+	byte id = _infoID;
+	_infoID = ALL_SERVOS;
+	if (_infoCallback != NULL)
+	{
+		_infoCallback(id, _model, _firmwareVersion, _serialNumber);
+	}
+}
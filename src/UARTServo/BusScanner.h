@@ -0,0 +1,135 @@
+// BusScanner.h
+
+#ifndef BUSSCANNER_H
+#define BUSSCANNER_H
+
+#include "UARTServo.h"
+
+/// Maximum number of requests of a scan waiting for their responses.
+#ifndef SCAN_IN_FLIGHT
+#define SCAN_IN_FLIGHT			8
+#endif
+
+/// Default time a servo takes to start its reply(unit: micro second).
+#define SCAN_TURNAROUND			500
+
+/*!
+ * BusScanner class
+ * Discovers the servos of a bus by pinging a range of IDs, with several pings in flight.
+ * A ping expires after the wire time of the request and its reply at the connecting rate, plus twice the turnaround time,
+ * instead of the request timeout. Pings are spaced by the time of one exchange, so replies never overlap
+ * on a half-duplex bus, while the deadlines of the silent IDs run in parallel.
+ * Optionally, the model, firmware version and serial number (data IDs 6-8) of each servo found are read in the same pass.
+ *
+ * Attach it to a UARTServo object and call start(), the scan runs from UARTServo::update().
+ */
+class BusScanner : public UARTServoTask, public ResponseHandler
+{
+public:
+	BusScanner();
+
+	/*!
+	 * Start a scan.
+	 *
+	 * \param servo The UARTServo object it is attached to, for the connecting rate.
+	 * \param firstID First servo ID.
+	 * \param lastID Last servo ID.
+	 * \return false if a scan is running.
+	 */
+	bool start(const UARTServo& servo, byte firstID = 0, byte lastID = 0xfd);
+
+	/*!
+	 * Set the function called for every servo found, as soon as it answers.
+	 *
+	 * \param callback Callback function. The parameter is Servo ID(byte).
+	 */
+	void setFoundCallback(void(*callback)(byte));
+
+	/*!
+	 * Set the function called with the identity of every servo found. If it is set, data IDs 6-8 are read.
+	 *
+	 * \param callback Callback function, NULL to skip the reads. The parameters in order are Servo ID(byte), model(unsigned int),
+	 * firmware version(unsigned int), and serial number(unsigned long). A field that could not be read is zero.
+	 */
+	void setInfoCallback(void(*callback)(byte, unsigned int, unsigned int, unsigned long));
+
+	/*!
+	 * Set the function called when the scan is finished.
+	 *
+	 * \param callback Callback function. The parameter is the number of servos found(byte).
+	 */
+	void setFinishCallback(void(*callback)(byte));
+
+	/*!
+	 * Limit the number of requests in flight, at most SCAN_IN_FLIGHT. Default value is 4.
+	 */
+	void setMaxInFlight(byte count);
+
+	/*!
+	 * Set the time a servo takes to start its reply, default value is SCAN_TURNAROUND.
+	 *
+	 * \param turnaround Turnaround time(unit: micro second).
+	 */
+	void setTurnaround(unsigned long turnaround);
+
+	/// Whether a scan is running.
+	bool isRunning() const;
+
+	/// Number of servos found by the last scan.
+	byte getCount() const;
+
+	/// Whether a servo has been found by the last scan.
+	bool isFound(byte id) const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+	void onResponse(byte id, byte number, const byte* payload, byte length);
+
+private:
+	struct Request
+	{
+		/// Packet number, zero if this slot is free.
+		byte number;
+		byte id;
+		/// Deadline(unit: micro second).
+		unsigned long deadline;
+	};
+
+	bool _running;
+	byte _lastID;
+	unsigned int _cursor;
+	byte _count;
+	byte _found[32];
+	byte _maxInFlight;
+	unsigned long _turnaround;
+	unsigned long _pingTime;
+	unsigned long _readTime;
+	unsigned long _nextSend;
+	Request _requests[SCAN_IN_FLIGHT];
+
+	/// Servos found whose identity is still to be read.
+	byte _infoQueue[SCAN_IN_FLIGHT * 2];
+	byte _infoQueued;
+	/// Servo whose identity is being read, and the next data ID to read.
+	byte _infoID;
+	byte _infoDataID;
+	bool _infoInFlight;
+	unsigned int _model;
+	unsigned int _firmwareVersion;
+	unsigned long _serialNumber;
+
+	void(*_foundCallback)(byte);
+	void(*_infoCallback)(byte, unsigned int, unsigned int, unsigned long);
+	void(*_finishCallback)(byte);
+
+	Request* findRequest(byte id, byte number);
+	byte getInFlight() const;
+	/// Whether an identity read is ready to be sent.
+	bool hasInfoWork() const;
+	/// Whether a ping is ready to be sent.
+	bool hasPingWork() const;
+	bool send(UARTServo& servo, byte number, byte id, byte dataID, unsigned long now);
+	void nextInfo();
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "BusScheduler.h"
+
+BusScheduler::BusScheduler()
+	: _sequence(0), _period(SCHEDULER_PERIOD), _utilization(80), _turnaround(100), _due(0), _overruns(0)
+{
+	for (byte i = 0; i < SCHEDULER_ENTRIES; i++)
+	{
+		_entries[i].priority = SCHEDULER_PRIORITIES;
+	}
+	for (byte i = 0; i < SCHEDULER_PRIORITIES; i++)
+	{
+		_queued[i] = 0;
+	}
+}
+
+void BusScheduler::setPeriod(unsigned long period, byte utilization)
+{
+	_period = period;
+	_utilization = utilization;
+}
+
+void BusScheduler::setTurnaround(unsigned long turnaround)
+{
+	_turnaround = turnaround;
+}
+
+bool BusScheduler::submit(byte priority, byte number, const byte* payload, byte size, ResponseHandler* handler, byte replySize)
+{
+	if (priority >= SCHEDULER_PRIORITIES || size == 0 || size > SCHEDULER_PAYLOAD)
+	{
+		return false;
+	}
+	for (byte i = 0; i < SCHEDULER_ENTRIES; i++)
+	{
+		Entry* entry = &_entries[i];
+		if (entry->priority == SCHEDULER_PRIORITIES)
+		{
+			entry->priority = priority;
+			entry->number = number;
+			entry->size = size;
+			entry->replySize = (replySize == REPLY_SIZE_AUTO) ? getReplySize(number, payload, size) : replySize;
+			entry->sequence = _sequence++;
+			entry->handler = handler;
+			memcpy(entry->payload, payload, size);
+			_queued[priority]++;
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned long BusScheduler::getCost(const UARTServo& servo, byte size, byte replySize) const
+{
+	unsigned long cost = servo.getWireTime(size + FRAME_OVERHEAD);
+	if (replySize > 0)
+	{
+		cost += _turnaround + servo.getWireTime(replySize + FRAME_OVERHEAD);
+	}
+	return cost;
+}
+
+byte BusScheduler::getReplySize(byte number, const byte* payload, byte size)
+{
+	if (payload[0] == ALL_SERVOS)
+	{
+		return 0;
+	}
+	switch (number)
+	{
+		case PACKET_PING:
+		{
+			return 1;
+		}
+		case PACKET_READ_DATA:
+		{
+			// ID, data ID and the value, of up to 4 bytes if the data ID is unknown.
+			byte dataSize = (size >= 2) ? getDataSize(payload[1]) : 0;
+			return 2 + ((dataSize > 0) ? dataSize : 4);
+		}
+		case PACKET_WRITE_DATA:
+		case PACKET_READ_ANGLE:
+		{
+			return 3;
+		}
+		case PACKET_READ_BATCH_DATA:
+		{
+			return SCHEDULER_PAYLOAD;
+		}
+		default:
+		{
+			// ID and result.
+			return 2;
+		}
+	}
+}
+
+byte BusScheduler::getQueued(byte priority) const
+{
+	return _queued[priority];
+}
+
+unsigned long BusScheduler::getOverruns() const
+{
+	return _overruns;
+}
+
+void BusScheduler::poll(UARTServo& servo, unsigned long now)
+{
+	if ((long)(now - _due) < 0)
+	{
+		return;
+	}
+	_due += _period;
+	if ((long)(now - _due) >= 0)
+	{
+		// Cycles have been missed, restart the cadence from now.
+		_due = now + _period;
+	}
+
+	unsigned long budget = _period * 10 * _utilization;
+	unsigned long spent = 0;
+	Entry* entry;
+	while ((entry = next()) != NULL)
+	{
+		unsigned long cost = getCost(servo, entry->size, entry->replySize);
+		// A request larger than a whole budget still goes out, alone in its cycle.
+		if (spent + cost > budget && spent > 0)
+		{
+			break;
+		}
+		if (!servo.sendRequest(entry->number, entry->payload, entry->size, entry->handler))
+		{
+			// The pending-request table is full, try again next cycle.
+			break;
+		}
+		_queued[entry->priority]--;
+		entry->priority = SCHEDULER_PRIORITIES;
+		spent += cost;
+	}
+	if (entry != NULL)
+	{
+		_overruns++;
+	}
+}
+
+unsigned long BusScheduler::getPollDelay(unsigned long now) const
+{
+	long left = (long)(_due - now);
+	return (left > 0) ? left : 0;
+}
+
+BusScheduler::Entry* BusScheduler::next()
+{
+	for (byte priority = 0; priority < SCHEDULER_PRIORITIES; priority++)
+	{
+		if (_queued[priority] == 0)
+		{
+			continue;
+		}
+		Entry* oldest = NULL;
+		for (byte i = 0; i < SCHEDULER_ENTRIES; i++)
+		{
+			Entry* entry = &_entries[i];
+			if (entry->priority == priority && (oldest == NULL || (long)(entry->sequence - oldest->sequence) < 0))
+			{
+				oldest = entry;
+			}
+		}
+		return oldest;
+	}
+	return NULL;
+}
@@ -0,0 +1,131 @@
+// BusScheduler.h
+
+#ifndef BUSSCHEDULER_H
+#define BUSSCHEDULER_H
+
+#include "UARTServo.h"
+
+/// Priority of motion commands, the highest.
+#define PRIORITY_MOTION			0
+/// Priority of status requests, e.g. ping and read angle.
+#define PRIORITY_STATUS			1
+/// Priority of telemetry polls.
+#define PRIORITY_TELEMETRY		2
+/// Priority of configuration reads and writes, the lowest.
+#define PRIORITY_CONFIGURATION	3
+/// Number of priority classes.
+#define SCHEDULER_PRIORITIES	4
+
+/// Maximum number of queued requests.
+#ifndef SCHEDULER_ENTRIES
+#ifdef ARDUINO
+#define SCHEDULER_ENTRIES		8
+#else
+#define SCHEDULER_ENTRIES		32
+#endif
+#endif
+
+/// Largest queued payload, the write batch data request.
+#define SCHEDULER_PAYLOAD		33
+
+/// Default cycle time(unit: millisecond).
+#define SCHEDULER_PERIOD		10
+
+/// Reply size derived from the packet number, see BusScheduler::submit().
+#define REPLY_SIZE_AUTO			0xff
+
+/*!
+ * BusScheduler class
+ * Sends queued requests in cycles, within a budget of wire time per cycle.
+ * The wire time of a request is computed from the connecting rate and the frame sizes of the request
+ * and its expected reply, plus a turnaround time of the servo.
+ * Requests go out in strict priority: a request never overtakes a waiting one of a higher priority,
+ * so a configuration readback waits for a cycle with room instead of delaying motion commands.
+ *
+ * Attach it to a UARTServo object, the cycles run from UARTServo::update().
+ */
+class BusScheduler : public UARTServoTask
+{
+public:
+	BusScheduler();
+
+	/*!
+	 * Set the cycle time, default value is SCHEDULER_PERIOD.
+	 *
+	 * \param period Cycle time(unit: millisecond).
+	 * \param utilization Share of the cycle given to the queued requests(unit: percent), default value is 80.
+	 */
+	void setPeriod(unsigned long period, byte utilization = 80);
+
+	/*!
+	 * Set the time a servo takes to start its reply, default value is 100.
+	 *
+	 * \param turnaround Turnaround time(unit: micro second).
+	 */
+	void setTurnaround(unsigned long turnaround);
+
+	/*!
+	 * Queue a request, it is sent by UARTServo::sendRequest().
+	 *
+	 * \param priority PRIORITY_MOTION, PRIORITY_STATUS, PRIORITY_TELEMETRY or PRIORITY_CONFIGURATION.
+	 * \param number Packet number.
+	 * \param payload Request payload, starting with the servo ID.
+	 * \param size Payload size, at most SCHEDULER_PAYLOAD.
+	 * \param handler Handler of the response, NULL to ignore it.
+	 * \param replySize Expected reply payload size, REPLY_SIZE_AUTO to derive it from the packet number.
+	 * \return false if the queue is full or the request is too large.
+	 */
+	bool submit(byte priority, byte number, const byte* payload, byte size, ResponseHandler* handler = NULL, byte replySize = REPLY_SIZE_AUTO);
+
+	/*!
+	 * Wire time of a request and its reply at the connecting rate of a UARTServo object.
+	 *
+	 * \return Wire time(unit: micro second).
+	 */
+	unsigned long getCost(const UARTServo& servo, byte size, byte replySize) const;
+
+	/*!
+	 * Expected reply payload size of a request, zero if the servo does not reply.
+	 *
+	 * \param number Packet number.
+	 * \param payload Request payload, starting with the servo ID. No servo replies to ALL_SERVOS.
+	 * \param size Payload size.
+	 */
+	static byte getReplySize(byte number, const byte* payload, byte size);
+
+	/// Number of requests waiting with a priority.
+	byte getQueued(byte priority) const;
+
+	/// Number of cycles that ended with requests still waiting.
+	unsigned long getOverruns() const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+
+private:
+	struct Entry
+	{
+		/// Priority, SCHEDULER_PRIORITIES if this entry is free.
+		byte priority;
+		byte number;
+		byte size;
+		byte replySize;
+		/// Queue order, the oldest request of a priority is sent first.
+		unsigned long sequence;
+		ResponseHandler* handler;
+		byte payload[SCHEDULER_PAYLOAD];
+	};
+
+	Entry _entries[SCHEDULER_ENTRIES];
+	byte _queued[SCHEDULER_PRIORITIES];
+	unsigned long _sequence;
+	unsigned long _period;
+	byte _utilization;
+	unsigned long _turnaround;
+	unsigned long _due;
+	unsigned long _overruns;
+
+	Entry* next();
+};
+
+#endif
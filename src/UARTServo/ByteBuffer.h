@@ -1,17 +1,17 @@
 #ifndef BYTEBUFFER_H
 #define BYTEBUFFER_H
 
-#if defined(ARDUINO) && ARDUINO >= 100
-#include "Arduino.h"
-#else
-#include "WProgram.h"
-#endif
+#include "Platform.h"
 
+/*!
+ * ByteBuffer class
+ * Ring buffer of N bytes held in place, N must be a power of two so that indexes wrap with a mask.
+ */
+template<unsigned int N>
 class ByteBuffer
 {
 public:
-	void init(unsigned int bufferSize);
-	void destory();
+	ByteBuffer();
 	void clear();
 	unsigned int getCapacity();
 	unsigned int getLength();
@@ -33,12 +33,255 @@ public:
 	void writeFloat(float data);
 	bool checksum();
 	byte writeChecksum(unsigned int startIndex = 0, unsigned int endIndex = 0);
+#ifdef SERVO_STATISTICS
+	/// Number of bytes discarded by write() because the buffer was full.
+	unsigned long getDropped();
+#endif
 
 private:
-	byte* _data;
-	unsigned int _capacity;
+	static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+	static const unsigned int MASK = N - 1;
+
+	byte _data[N];
 	unsigned int _position;
 	unsigned int _length;
+#ifdef SERVO_STATISTICS
+	unsigned long _dropped;
+#endif
 };
 
-#endif
\ No newline at end of file
+template<unsigned int N>
+ByteBuffer<N>::ByteBuffer()
+	: _position(0), _length(0)
+{
+#ifdef SERVO_STATISTICS
+	_dropped = 0;
+#endif
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::clear()
+{
+	_position = 0;
+	_length = 0;
+}
+
+template<unsigned int N>
+unsigned int ByteBuffer<N>::getCapacity()
+{
+	return N;
+}
+
+template<unsigned int N>
+unsigned int ByteBuffer<N>::getLength()
+{
+	return _length;
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::back(unsigned int step)
+{
+	if (_length + step < N)
+	{
+		_position = (_position - step) & MASK;
+		_length += step;
+	}
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::forward(unsigned int step)
+{
+	if (_length > step)
+	{
+		_position = (_position + step) & MASK;
+		_length -= step;
+	}
+}
+
+template<unsigned int N>
+byte ByteBuffer<N>::read()
+{
+	byte val = 0;
+
+	if (_length > 0)
+	{
+		val = _data[_position];
+		_position = (_position + 1) & MASK;
+		_length--;
+	}
+
+	return val;
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::read(void* dest, size_t size)
+{
+	byte* data = (byte*)dest;
+	size_t count = (size < _length) ? size : _length;
+	// Copy in at most two runs, before and after the wrap.
+	size_t first = N - _position;
+	if (first > count)
+	{
+		first = count;
+	}
+	memcpy(data, _data + _position, first);
+	memcpy(data + first, _data, count - first);
+	_position = (_position + count) & MASK;
+	_length -= count;
+	for (size_t i = count; i < size; i++)
+	{
+		data[i] = 0;
+	}
+}
+
+// Integers are 16-bit and longs are 32-bit little-endian on the wire,
+// whatever their size on the running platform.
+template<unsigned int N>
+int ByteBuffer<N>::readInt()
+{
+	return (int16_t)readUInt();
+}
+
+template<unsigned int N>
+unsigned int ByteBuffer<N>::readUInt()
+{
+	unsigned int val = read();
+	val |= (unsigned int)read() << 8;
+	return val;
+}
+
+template<unsigned int N>
+long ByteBuffer<N>::readLong()
+{
+	return (int32_t)readULong();
+}
+
+template<unsigned int N>
+unsigned long ByteBuffer<N>::readULong()
+{
+	unsigned long val = readUInt();
+	val |= (unsigned long)readUInt() << 16;
+	return val;
+}
+
+template<unsigned int N>
+float ByteBuffer<N>::readFloat()
+{
+	float val;
+	byte *p = (byte *)&val;
+	p[0] = read();
+	p[1] = read();
+	p[2] = read();
+	p[3] = read();
+	return val;
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::write(byte data)
+{
+	if (_length < N)
+	{
+		_data[(_position + _length) & MASK] = data;
+		_length++;
+	}
+#ifdef SERVO_STATISTICS
+	else
+	{
+		_dropped++;
+	}
+#endif
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::write(const void * src, size_t size)
+{
+	const byte* data = (const byte*)src;
+	size_t count = N - _length;
+	if (count > size)
+	{
+		count = size;
+	}
+#ifdef SERVO_STATISTICS
+	_dropped += size - count;
+#endif
+	// Copy in at most two runs, before and after the wrap.
+	unsigned int tail = (_position + _length) & MASK;
+	size_t first = N - tail;
+	if (first > count)
+	{
+		first = count;
+	}
+	memcpy(_data + tail, data, first);
+	memcpy(_data, data + first, count - first);
+	_length += count;
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::writeInt(int data)
+{
+	writeUInt((unsigned int)data);
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::writeUInt(unsigned int data)
+{
+	write((byte)data);
+	write((byte)(data >> 8));
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::writeLong(long data)
+{
+	writeULong((unsigned long)data);
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::writeULong(unsigned long data)
+{
+	writeUInt((unsigned int)(data & 0xffff));
+	writeUInt((unsigned int)(data >> 16));
+}
+
+template<unsigned int N>
+void ByteBuffer<N>::writeFloat(float data)
+{
+	byte *p = (byte *)&data;
+	write(p[0]);
+	write(p[1]);
+	write(p[2]);
+	write(p[3]);
+}
+
+template<unsigned int N>
+bool ByteBuffer<N>::checksum()
+{
+	byte val = 0;
+	for (unsigned int i = 0; i + 1 < _length; i++)
+	{
+		val += _data[(_position + i) & MASK];
+	}
+	return (val == _data[(_position + _length - 1) & MASK]);
+}
+
+template<unsigned int N>
+byte ByteBuffer<N>::writeChecksum(unsigned int startIndex, unsigned int endIndex)
+{
+	byte val = 0;
+	unsigned int end = (endIndex > startIndex) ? endIndex : _length;
+	for (unsigned int i = startIndex; i < end; i++)
+	{
+		val += _data[(_position + i) & MASK];
+	}
+	write(val);
+	return val;
+}
+
+#ifdef SERVO_STATISTICS
+template<unsigned int N>
+unsigned long ByteBuffer<N>::getDropped()
+{
+	return _dropped;
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+// Frame.h
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "Platform.h"
+
+/// Header of frames sent to the servos.
+#define REQUEST_HEADER		0x4c12
+/// Header of frames sent back by the servos.
+#define RESPONSE_HEADER		0x1c05
+/// Header (2 bytes), packet number, packet length and checksum.
+#define FRAME_OVERHEAD		5
+/// Longest frame, the packet length is a single byte.
+#define MAX_FRAME_LENGTH	(255 + FRAME_OVERHEAD)
+
+/*!
+ * FrameWriter class
+ * Encode a frame into a contiguous buffer: header, packet number, packet length, payload and checksum.
+ * Fields are little-endian, integers take 2 bytes.
+ */
+class FrameWriter
+{
+public:
+	/*!
+	 * \param buffer Destination buffer, it should hold at least size + FRAME_OVERHEAD bytes.
+	 * \param capacity Size of the destination buffer.
+	 */
+	FrameWriter(byte* buffer, size_t capacity)
+		: _data(buffer), _capacity(capacity), _length(0), _sum(0)
+	{
+	}
+
+	/*!
+	 * Start a new frame.
+	 *
+	 * \param header REQUEST_HEADER or RESPONSE_HEADER.
+	 * \param number Packet number.
+	 * \param size Payload size.
+	 */
+	void begin(unsigned int header, byte number, byte size)
+	{
+		_length = 0;
+		_sum = 0;
+		writeUInt(header);
+		write(number);
+		write(size);
+	}
+
+	void write(byte data)
+	{
+		if (_length < _capacity)
+		{
+			_data[_length++] = data;
+			_sum += data;
+		}
+	}
+
+	void write(const void* src, size_t size)
+	{
+		const byte* data = (const byte*)src;
+		for (size_t i = 0; i < size; i++)
+		{
+			write(data[i]);
+		}
+	}
+
+	void writeInt(int data)
+	{
+		writeUInt((unsigned int)data);
+	}
+
+	void writeUInt(unsigned int data)
+	{
+		write((byte)data);
+		write((byte)(data >> 8));
+	}
+
+	/*!
+	 * Append the checksum.
+	 *
+	 * \return Frame length.
+	 */
+	size_t end()
+	{
+		write(_sum);
+		return _length;
+	}
+
+	const byte* getData() const
+	{
+		return _data;
+	}
+
+	size_t getLength() const
+	{
+		return _length;
+	}
+
+private:
+	byte* _data;
+	size_t _capacity;
+	size_t _length;
+	byte _sum;
+};
+
+/*!
+ * FrameReader class
+ * Decode the fields of a frame payload, reads beyond the payload return zero.
+ */
+class FrameReader
+{
+public:
+	FrameReader(const byte* data, size_t size)
+		: _data(data), _size(size), _position(0)
+	{
+	}
+
+	byte read()
+	{
+		return (_position < _size) ? _data[_position++] : 0;
+	}
+
+	void read(void* dest, size_t size)
+	{
+		byte* data = (byte*)dest;
+		for (size_t i = 0; i < size; i++)
+		{
+			data[i] = read();
+		}
+	}
+
+	int readInt()
+	{
+		return (int16_t)readUInt();
+	}
+
+	unsigned int readUInt()
+	{
+		unsigned int val = read();
+		val |= (unsigned int)read() << 8;
+		return val;
+	}
+
+	unsigned long readULong()
+	{
+		unsigned long val = readUInt();
+		val |= (unsigned long)readUInt() << 16;
+		return val;
+	}
+
+	/// Current position in the payload.
+	const byte* getData() const
+	{
+		return _data + _position;
+	}
+
+	/// Number of bytes left.
+	size_t getRemaining() const
+	{
+		return _size - _position;
+	}
+
+private:
+	const byte* _data;
+	size_t _size;
+	size_t _position;
+};
+
+/*!
+ * RequestFrame class
+ * A request frame of fixed payload size, the offset of each field is a template parameter
+ * so the whole layout is resolved at compile time.
+ */
+template<byte Number, byte Size>
+class RequestFrame
+{
+public:
+	/// Payload size.
+	static const byte SIZE = Size;
+	/// Frame length.
+	static const size_t LENGTH = Size + FRAME_OVERHEAD;
+
+	RequestFrame()
+	{
+		_data[0] = (byte)REQUEST_HEADER;
+		_data[1] = (byte)(REQUEST_HEADER >> 8);
+		_data[2] = Number;
+		_data[3] = Size;
+	}
+
+	template<byte Offset>
+	void put(byte data)
+	{
+		static_assert(Offset < Size, "field out of payload");
+		_data[4 + Offset] = data;
+	}
+
+	template<byte Offset>
+	void putInt(int data)
+	{
+		putUInt<Offset>((unsigned int)data);
+	}
+
+	template<byte Offset>
+	void putUInt(unsigned int data)
+	{
+		static_assert(Offset + 2 <= Size, "field out of payload");
+		_data[4 + Offset] = (byte)data;
+		_data[5 + Offset] = (byte)(data >> 8);
+	}
+
+	/*!
+	 * Append the checksum, the sum of the header part is a constant.
+	 *
+	 * \return Frame data, LENGTH bytes.
+	 */
+	const byte* seal()
+	{
+		byte sum = (byte)((REQUEST_HEADER & 0xff) + (REQUEST_HEADER >> 8) + Number + Size);
+		for (byte i = 0; i < Size; i++)
+		{
+			sum += _data[4 + i];
+		}
+		_data[LENGTH - 1] = sum;
+		return _data;
+	}
+
+	/// Payload, SIZE bytes, for a request sent by UARTServo::sendRequest().
+	const byte* getPayload() const
+	{
+		return _data + 4;
+	}
+
+private:
+	byte _data[LENGTH];
+};
+
+#endif
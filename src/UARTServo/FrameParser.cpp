@@ -0,0 +1,180 @@
+#include "FrameParser.h"
+
+FrameParser::FrameParser(unsigned int header)
+	: _headerLow((byte)header), _headerHigh((byte)(header >> 8))
+{
+	reset();
+#ifdef SERVO_STATISTICS
+	clearStatistics();
+#endif
+}
+
+void FrameParser::reset()
+{
+	_state = HEADER_LOW;
+	_number = 0;
+	_length = 0;
+	_index = 0;
+	_sum = 0;
+}
+
+bool FrameParser::parse(byte data)
+{
+	switch (_state)
+	{
+		case COMPLETE:
+		case HEADER_LOW:
+		{
+			if (data == _headerLow)
+			{
+				_sum = data;
+				_state = HEADER_HIGH;
+			}
+			else
+			{
+				_state = HEADER_LOW;
+#ifdef SERVO_STATISTICS
+				_discardedBytes++;
+#endif
+			}
+			break;
+		}
+		case HEADER_HIGH:
+		{
+			if (data == _headerHigh)
+			{
+				_sum += data;
+				_state = NUMBER;
+			}
+			else if (data != _headerLow)
+			{
+				// A repeated low byte may still start the header.
+				_state = HEADER_LOW;
+#ifdef SERVO_STATISTICS
+				_discardedBytes += 2;
+#endif
+			}
+#ifdef SERVO_STATISTICS
+			else
+			{
+				_discardedBytes++;
+			}
+#endif
+			break;
+		}
+		case NUMBER:
+		{
+			_number = data;
+			_sum += data;
+			_state = LENGTH;
+			break;
+		}
+		case LENGTH:
+		{
+			_length = data;
+			_index = 0;
+			_sum += data;
+			_state = (_length > 0) ? PAYLOAD : CHECKSUM;
+			break;
+		}
+		case PAYLOAD:
+		{
+			_payload[_index++] = data;
+			_sum += data;
+			if (_index == _length)
+			{
+				_state = CHECKSUM;
+			}
+			break;
+		}
+		case CHECKSUM:
+		{
+			if (data == _sum)
+			{
+				_state = COMPLETE;
+				return true;
+			}
+			// As checksum error occurs, drop the frame.
+			_state = HEADER_LOW;
+#ifdef SERVO_STATISTICS
+			_checksumErrors++;
+#endif
+			break;
+		}
+	}
+	return false;
+}
+
+size_t FrameParser::parse(const byte* data, size_t size)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		if (_state == PAYLOAD)
+		{
+			// Copy the payload in one run.
+			size_t count = _length - _index;
+			if (count > size - i)
+			{
+				count = size - i;
+			}
+			byte sum = _sum;
+			byte* dest = _payload + _index;
+			for (size_t j = 0; j < count; j++)
+			{
+				dest[j] = data[i + j];
+				sum += data[i + j];
+			}
+			_sum = sum;
+			_index += count;
+			i += count;
+			if (_index == _length)
+			{
+				_state = CHECKSUM;
+			}
+		}
+		else if (parse(data[i++]))
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+bool FrameParser::isComplete() const
+{
+	return _state == COMPLETE;
+}
+
+byte FrameParser::getNumber() const
+{
+	return _number;
+}
+
+byte FrameParser::getLength() const
+{
+	return _length;
+}
+
+const byte* FrameParser::getPayload() const
+{
+	return _payload;
+}
+
+#ifdef SERVO_STATISTICS
+unsigned long FrameParser::getChecksumErrors() const
+{
+	return _checksumErrors;
+}
+
+unsigned long FrameParser::getDiscardedBytes() const
+{
+	return _discardedBytes;
+}
+
+void FrameParser::clearStatistics()
+{
+	_checksumErrors = 0;
+	_discardedBytes = 0;
+}
+#endif
@@ -0,0 +1,91 @@
+// FrameParser.h
+
+#ifndef FRAMEPARSER_H
+#define FRAMEPARSER_H
+
+#include "Frame.h"
+
+/*!
+ * FrameParser class
+ * Byte-at-a-time state machine that extracts frames from a byte stream.
+ * The checksum is summed while bytes arrive, so each byte costs O(1) and nothing is scanned twice.
+ * After noise or a checksum error, it resynchronizes on the next header.
+ */
+class FrameParser
+{
+public:
+	/*!
+	 * \param header RESPONSE_HEADER to parse servo responses, REQUEST_HEADER to parse requests.
+	 */
+	FrameParser(unsigned int header = RESPONSE_HEADER);
+
+	/*!
+	 * Drop the partial frame and wait for the next header.
+	 */
+	void reset();
+
+	/*!
+	 * Feed one byte.
+	 *
+	 * \return true if a valid frame is completed by this byte.
+	 */
+	bool parse(byte data);
+
+	/*!
+	 * Feed a chunk of bytes, it stops right after a completed frame.
+	 * Call it again with the remaining bytes once the frame is handled.
+	 *
+	 * \param data Received bytes.
+	 * \param size Number of received bytes.
+	 * \return Number of bytes consumed.
+	 */
+	size_t parse(const byte* data, size_t size);
+
+	/*!
+	 * Whether a valid frame has been completed by the last byte fed.
+	 */
+	bool isComplete() const;
+
+	/// Packet number of the completed frame.
+	byte getNumber() const;
+	/// Payload length of the completed frame.
+	byte getLength() const;
+	/// Payload of the completed frame, valid until the next byte is fed.
+	const byte* getPayload() const;
+
+#ifdef SERVO_STATISTICS
+	/// Number of frames dropped by a checksum error.
+	unsigned long getChecksumErrors() const;
+	/// Number of bytes skipped while looking for a header.
+	unsigned long getDiscardedBytes() const;
+	/// Clear the counters above.
+	void clearStatistics();
+#endif
+
+private:
+	enum State
+	{
+		HEADER_LOW,
+		HEADER_HIGH,
+		NUMBER,
+		LENGTH,
+		PAYLOAD,
+		CHECKSUM,
+		COMPLETE
+	};
+
+	byte _headerLow;
+	byte _headerHigh;
+	byte _state;
+	byte _number;
+	byte _length;
+	byte _index;
+	byte _sum;
+	byte _payload[255];
+#ifdef SERVO_STATISTICS
+	unsigned long _checksumErrors;
+	unsigned long _discardedBytes;
+#endif
+};
+
+#endif
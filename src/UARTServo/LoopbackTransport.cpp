@@ -0,0 +1,56 @@
+#include "LoopbackTransport.h"
+
+LoopbackTransport::LoopbackTransport()
+	: _peer(NULL)
+{
+}
+
+void LoopbackTransport::connect(LoopbackTransport* peer)
+{
+	_peer = peer;
+	peer->_peer = this;
+}
+
+bool LoopbackTransport::begin(unsigned long)
+{
+	return true;
+}
+
+size_t LoopbackTransport::available()
+{
+	return _rxBuffer.getLength();
+}
+
+size_t LoopbackTransport::read(byte* dest, size_t size)
+{
+	size_t count = _rxBuffer.getLength();
+	if (count > size)
+	{
+		count = size;
+	}
+	_rxBuffer.read(dest, count);
+	return count;
+}
+
+size_t LoopbackTransport::write(const byte* src, size_t size)
+{
+	if (_peer == NULL)
+	{
+		return 0;
+	}
+	size_t count = _peer->_rxBuffer.getCapacity() - _peer->_rxBuffer.getLength();
+	if (count > size)
+	{
+		count = size;
+	}
+	// The buffer takes what fits and counts the rest as dropped, see getDropped().
+	_peer->_rxBuffer.write(src, size);
+	return count;
+}
+
+#ifdef SERVO_STATISTICS
+unsigned long LoopbackTransport::getDropped()
+{
+	return _rxBuffer.getDropped();
+}
+#endif
@@ -0,0 +1,48 @@
+// LoopbackTransport.h
+
+#ifndef LOOPBACKTRANSPORT_H
+#define LOOPBACKTRANSPORT_H
+
+#include "UARTTransport.h"
+#include "ByteBuffer.h"
+
+/// Size of the receive buffer of a loopback transport, a power of two.
+#ifndef LOOPBACK_BUFFER_SIZE
+#ifdef ARDUINO
+#define LOOPBACK_BUFFER_SIZE	128
+#else
+#define LOOPBACK_BUFFER_SIZE	4096
+#endif
+#endif
+
+/*!
+ * LoopbackTransport class
+ * In-process transport, bytes written to one end are received by its peer.
+ * It is mainly used for tests without physical servos.
+ */
+class LoopbackTransport : public UARTTransport
+{
+public:
+	LoopbackTransport();
+
+	/*!
+	 * Connect two transports with each other.
+	 */
+	void connect(LoopbackTransport* peer);
+
+	bool begin(unsigned long baud);
+	size_t available();
+	size_t read(byte* dest, size_t size);
+	size_t write(const byte* src, size_t size);
+
+#ifdef SERVO_STATISTICS
+	/// Number of bytes the peer wrote while the receive buffer was full.
+	unsigned long getDropped();
+#endif
+
+private:
+	LoopbackTransport* _peer;
+	ByteBuffer<LOOPBACK_BUFFER_SIZE> _rxBuffer;
+};
+
+#endif
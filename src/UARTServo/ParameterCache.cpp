@@ -0,0 +1,377 @@
+#include "ParameterCache.h"
+
+/// Wire size of a write batch data exchange: request frame and reply frame.
+#define BATCH_WRITE_COST		(1 + USER_DATA_SIZE + FRAME_OVERHEAD + 2 + FRAME_OVERHEAD)
+
+/// All fields of the user data area.
+#define ALL_FIELDS				((1UL << USER_DATA_FIELDS) - 1)
+
+ParameterCache::ParameterCache()
+	: _count(0), _commitCallback(NULL), _servo(NULL), _blocked(false)
+{
+}
+
+int ParameterCache::add(byte id)
+{
+	if (_count >= PARAMETER_CACHE_SERVOS)
+	{
+		return -1;
+	}
+	byte index = _count++;
+	_ids[index] = id;
+	_flags[index] = 0;
+	_dirty[index] = 0;
+	_writing[index] = 0;
+	memset(_data[index], 0, USER_DATA_SIZE);
+	return index;
+}
+
+void ParameterCache::clear()
+{
+	// Stop waiting for the requests in flight, so their late responses are not matched against new servos.
+	static const byte numbers[] = { PACKET_READ_BATCH_DATA, PACKET_WRITE_DATA, PACKET_WRITE_BATCH_DATA };
+	for (byte i = 0; i < _count; i++)
+	{
+		if ((_flags[i] & FLAG_LOADING) == 0 && _writing[i] == 0)
+		{
+			continue;
+		}
+		for (byte n = 0; n < sizeof(numbers); n++)
+		{
+			while (_servo->cancelRequest(_ids[i], numbers[n], this))
+			{
+			}
+		}
+	}
+	_count = 0;
+}
+
+int ParameterCache::find(byte id) const
+{
+	for (byte i = 0; i < _count; i++)
+	{
+		if (_ids[i] == id)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+byte ParameterCache::getCount() const
+{
+	return _count;
+}
+
+void ParameterCache::load(byte index)
+{
+	_flags[index] |= FLAG_LOAD;
+}
+
+bool ParameterCache::isLoaded(byte index) const
+{
+	return (_flags[index] & FLAG_LOADED) != 0;
+}
+
+bool ParameterCache::get(byte index, byte dataID, long* value)
+{
+	byte offset, width;
+	if (!getUserDataField(dataID, &offset, &width))
+	{
+		return false;
+	}
+	if (!isLoaded(index))
+	{
+		load(index);
+		return false;
+	}
+	const byte* field = _data[index] + offset;
+	if (width == 1)
+	{
+		*value = field[0];
+	}
+	else if (isUserDataSigned(dataID))
+	{
+		*value = (int16_t)(field[0] | (field[1] << 8));
+	}
+	else
+	{
+		*value = (uint16_t)(field[0] | (field[1] << 8));
+	}
+	return true;
+}
+
+bool ParameterCache::set(byte index, byte dataID, long value)
+{
+	byte offset, width;
+	if (!getUserDataField(dataID, &offset, &width))
+	{
+		return false;
+	}
+	byte* field = _data[index] + offset;
+	bool changed = field[0] != (byte)value || (width == 2 && field[1] != (byte)(value >> 8));
+	field[0] = (byte)value;
+	if (width == 2)
+	{
+		field[1] = (byte)(value >> 8);
+	}
+	// Without a shadow copy, the servo may hold any value.
+	if (changed || !isLoaded(index))
+	{
+		_dirty[index] |= 1UL << (dataID - USER_DATA_FIRST_ID);
+	}
+	return true;
+}
+
+bool ParameterCache::isDirty(byte index) const
+{
+	return _dirty[index] != 0;
+}
+
+void ParameterCache::commit(byte index)
+{
+	_flags[index] = (_flags[index] | FLAG_COMMIT) & ~FLAG_FAILED;
+}
+
+void ParameterCache::commit()
+{
+	for (byte i = 0; i < _count; i++)
+	{
+		commit(i);
+	}
+}
+
+bool ParameterCache::isCommitting(byte index) const
+{
+	return (_flags[index] & FLAG_COMMIT) != 0;
+}
+
+void ParameterCache::setCommitCallback(void(*callback)(byte, byte))
+{
+	_commitCallback = callback;
+}
+
+void ParameterCache::poll(UARTServo& servo, unsigned long)
+{
+	_servo = &servo;
+	_blocked = false;
+	for (byte i = 0; i < _count; i++)
+	{
+		if ((_flags[i] & (FLAG_LOAD | FLAG_LOADING)) == FLAG_LOAD)
+		{
+			if (!servo.sendRequest(PACKET_READ_BATCH_DATA, &_ids[i], 1, this))
+			{
+				// The pending-request table is full, try again after a response or a request deadline.
+				_blocked = true;
+				return;
+			}
+			_flags[i] = (_flags[i] | FLAG_LOADING) & ~FLAG_LOAD;
+		}
+		if ((_flags[i] & FLAG_COMMIT) != 0 && !sendCommit(servo, i))
+		{
+			_blocked = true;
+			return;
+		}
+	}
+}
+
+unsigned long ParameterCache::getPollDelay(unsigned long) const
+{
+	if (_blocked)
+	{
+		return POLL_IDLE;
+	}
+	for (byte i = 0; i < _count; i++)
+	{
+		if ((_flags[i] & (FLAG_LOAD | FLAG_LOADING)) == FLAG_LOAD)
+		{
+			return 0;
+		}
+		// A commit waiting only for its responses has nothing to send, they finish it.
+		if ((_flags[i] & (FLAG_COMMIT | FLAG_FAILED)) == FLAG_COMMIT && (_dirty[i] != 0 || _writing[i] == 0))
+		{
+			return 0;
+		}
+	}
+	return POLL_IDLE;
+}
+
+void ParameterCache::onResponse(byte id, byte number, const byte* payload, byte length)
+{
+	int index = find(id);
+	if (index < 0)
+	{
+		return;
+	}
+	FrameReader reader(payload, length);
+	reader.read();
+	switch (number)
+	{
+		case PACKET_READ_BATCH_DATA:
+		{
+			_flags[index] &= ~FLAG_LOADING;
+			if (reader.getRemaining() != USER_DATA_SIZE)
+			{
+				break;
+			}
+			// Fields set locally keep their values.
+			const byte* data = reader.getData();
+			for (byte dataID = USER_DATA_FIRST_ID; dataID <= USER_DATA_LAST_ID; dataID++)
+			{
+				byte offset, width;
+				getUserDataField(dataID, &offset, &width);
+				if ((_dirty[index] & (1UL << (dataID - USER_DATA_FIRST_ID))) == 0)
+				{
+					memcpy(_data[index] + offset, data + offset, width);
+				}
+			}
+			_flags[index] |= FLAG_LOADED;
+			break;
+		}
+		case PACKET_WRITE_DATA:
+		{
+			byte dataID = reader.read();
+			byte result = reader.read();
+			if (dataID < USER_DATA_FIRST_ID || dataID > USER_DATA_LAST_ID)
+			{
+				break;
+			}
+			unsigned long field = 1UL << (dataID - USER_DATA_FIRST_ID);
+			_writing[index] &= ~field;
+			if (result == 0)
+			{
+				fail(index, field);
+			}
+			finishCommit(index);
+			break;
+		}
+		case PACKET_WRITE_BATCH_DATA:
+		{
+			byte result = reader.read();
+			unsigned long fields = _writing[index];
+			_writing[index] = 0;
+			if (result == 0)
+			{
+				fail(index, fields);
+			}
+			finishCommit(index);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+void ParameterCache::onTimeout(byte id, byte number, byte argument)
+{
+	int index = find(id);
+	if (index < 0)
+	{
+		return;
+	}
+	if (number == PACKET_READ_BATCH_DATA)
+	{
+		_flags[index] &= ~FLAG_LOADING;
+	}
+	else
+	{
+		// The argument of a write data request is its data ID, the key its response is matched by.
+		if (number == PACKET_WRITE_DATA && (argument < USER_DATA_FIRST_ID || argument > USER_DATA_LAST_ID))
+		{
+			return;
+		}
+		unsigned long fields = (number == PACKET_WRITE_DATA) ? (1UL << (argument - USER_DATA_FIRST_ID)) : _writing[index];
+		_writing[index] &= ~fields;
+		fail(index, fields);
+		finishCommit(index);
+	}
+}
+
+bool ParameterCache::sendCommit(UARTServo& servo, byte index)
+{
+	if ((_flags[index] & FLAG_FAILED) != 0)
+	{
+		return true;
+	}
+	unsigned long dirty = _dirty[index];
+	if (dirty == 0)
+	{
+		finishCommit(index);
+		return true;
+	}
+
+	// Compare the wire size of the write data exchanges with a single write batch data exchange.
+	unsigned int cost = 0;
+	for (byte i = 0; i < USER_DATA_FIELDS; i++)
+	{
+		if ((dirty & (1UL << i)) != 0)
+		{
+			byte offset, width;
+			getUserDataField(USER_DATA_FIRST_ID + i, &offset, &width);
+			// Request: ID, data ID and value. Reply: ID, data ID and result.
+			cost += 2 + width + FRAME_OVERHEAD + 3 + FRAME_OVERHEAD;
+		}
+	}
+	if (cost > BATCH_WRITE_COST && isLoaded(index) && _writing[index] == 0)
+	{
+		byte payload[1 + USER_DATA_SIZE];
+		payload[0] = _ids[index];
+		memcpy(payload + 1, _data[index], USER_DATA_SIZE);
+		// The reserved field must be 1 in a write.
+		payload[1] = 1;
+		if (!servo.sendRequest(PACKET_WRITE_BATCH_DATA, payload, sizeof(payload), this))
+		{
+			return false;
+		}
+		_writing[index] = ALL_FIELDS;
+		_dirty[index] = 0;
+		return true;
+	}
+
+	for (byte i = 0; i < USER_DATA_FIELDS; i++)
+	{
+		unsigned long field = 1UL << i;
+		if ((dirty & field) == 0)
+		{
+			continue;
+		}
+		byte offset, width;
+		getUserDataField(USER_DATA_FIRST_ID + i, &offset, &width);
+		byte payload[4] = { _ids[index], (byte)(USER_DATA_FIRST_ID + i), _data[index][offset], _data[index][offset + width - 1] };
+		if (!servo.sendRequest(PACKET_WRITE_DATA, payload, 2 + width, this))
+		{
+			// The pending-request table is full, go on in the next update.
+			return false;
+		}
+		_writing[index] |= field;
+		_dirty[index] &= ~field;
+	}
+	return true;
+}
+
+void ParameterCache::fail(byte index, unsigned long fields)
+{
+	// Keep the fields dirty, the next commit writes them again.
+	_dirty[index] |= fields;
+	_flags[index] |= FLAG_FAILED;
+}
+
+void ParameterCache::finishCommit(byte index)
+{
+	if ((_flags[index] & FLAG_COMMIT) == 0 || _writing[index] != 0)
+	{
+		return;
+	}
+	if (_dirty[index] != 0 && (_flags[index] & FLAG_FAILED) == 0)
+	{
+		return;
+	}
+	byte result = ((_flags[index] & FLAG_FAILED) != 0) ? 0 : 1;
+	_flags[index] &= ~(FLAG_COMMIT | FLAG_FAILED);
+	if (_commitCallback != NULL)
+	{
+		_commitCallback(_ids[index], result);
+	}
+}
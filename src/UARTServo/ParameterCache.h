@@ -0,0 +1,139 @@
+// ParameterCache.h
+
+#ifndef PARAMETERCACHE_H
+#define PARAMETERCACHE_H
+
+#include "UARTServo.h"
+
+/// Maximum number of cached servos.
+#ifndef PARAMETER_CACHE_SERVOS
+#define PARAMETER_CACHE_SERVOS	8
+#endif
+
+/*!
+ * ParameterCache class
+ * Keeps a shadow copy of the user data (data IDs 32-53) of each servo, in wire layout, read lazily by the read batch data command.
+ * Fields set through the cache are marked dirty. A commit sends only the dirty fields by the write data command,
+ * or a single write batch data command when that takes fewer bytes on the wire.
+ *
+ * Attach it to a UARTServo object, the requests are sent from UARTServo::update() as pending-request slots are free.
+ */
+class ParameterCache : public UARTServoTask, public ResponseHandler
+{
+public:
+	ParameterCache();
+
+	/*!
+	 * Cache the user data of a servo.
+	 *
+	 * \param id Servo ID.
+	 * \return Servo index, -1 if there is no room.
+	 */
+	int add(byte id);
+
+	/*!
+	 * Remove all servos, the requests waiting for their responses are cancelled.
+	 */
+	void clear();
+
+	/*!
+	 * Find the index of a servo.
+	 *
+	 * \return Servo index, -1 if it is not cached.
+	 */
+	int find(byte id) const;
+
+	/// Number of servos.
+	byte getCount() const;
+
+	/*!
+	 * Read the user data of a servo again.
+	 * Dirty fields keep their local values.
+	 */
+	void load(byte index);
+
+	/// Whether the user data of a servo has been read.
+	bool isLoaded(byte index) const;
+
+	/*!
+	 * Get a field, from the shadow copy.
+	 *
+	 * \param index Servo index.
+	 * \param dataID Data ID, from USER_DATA_FIRST_ID to USER_DATA_LAST_ID.
+	 * \param value The value, unsigned fields are zero-extended.
+	 * \return false if the field is unknown or not read yet, the user data is then read in the background.
+	 */
+	bool get(byte index, byte dataID, long* value);
+
+	/*!
+	 * Set a field, it is marked dirty unless the shadow copy already holds the value.
+	 *
+	 * \param index Servo index.
+	 * \param dataID Data ID, from USER_DATA_FIRST_ID to USER_DATA_LAST_ID.
+	 * \param value The value.
+	 * \return false if the field is unknown.
+	 */
+	bool set(byte index, byte dataID, long value);
+
+	/// Whether a servo has fields not written yet.
+	bool isDirty(byte index) const;
+
+	/*!
+	 * Write the dirty fields of a servo.
+	 *
+	 * \param index Servo index.
+	 */
+	void commit(byte index);
+
+	/*!
+	 * Write the dirty fields of all servos.
+	 */
+	void commit();
+
+	/// Whether a servo has a commit running.
+	bool isCommitting(byte index) const;
+
+	/*!
+	 * Set the function called when the commit of a servo is finished.
+	 *
+	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * The fields that failed stay dirty.
+	 */
+	void setCommitCallback(void(*callback)(byte, byte));
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+	void onResponse(byte id, byte number, const byte* payload, byte length);
+	void onTimeout(byte id, byte number, byte argument);
+
+private:
+	enum Flag
+	{
+		FLAG_LOADED = 0x01,
+		FLAG_LOAD = 0x02,
+		FLAG_LOADING = 0x04,
+		FLAG_COMMIT = 0x08,
+		FLAG_FAILED = 0x10
+	};
+
+	byte _ids[PARAMETER_CACHE_SERVOS];
+	byte _flags[PARAMETER_CACHE_SERVOS];
+	/// Fields to write and fields being written, bit i for data ID USER_DATA_FIRST_ID + i.
+	unsigned long _dirty[PARAMETER_CACHE_SERVOS];
+	unsigned long _writing[PARAMETER_CACHE_SERVOS];
+	byte _data[PARAMETER_CACHE_SERVOS][USER_DATA_SIZE];
+
+	byte _count;
+	void(*_commitCallback)(byte, byte);
+	/// The object the requests are sent through, set by poll().
+	UARTServo* _servo;
+	/// Whether the last poll found the pending-request table full.
+	bool _blocked;
+
+	/// Send the dirty fields of a servo, false if the pending-request table is full.
+	bool sendCommit(UARTServo& servo, byte index);
+	void fail(byte index, unsigned long fields);
+	void finishCommit(byte index);
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "Platform.h"
+
+#ifndef ARDUINO
+
+#include <time.h>
+
+static unsigned long long readMonotonicClock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned long long monotonicMicros()
+{
+	// Initialized once even when the first calls come from several threads, see ServoThread.
+	static const unsigned long long origin = readMonotonicClock();
+	return readMonotonicClock() - origin;
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(monotonicMicros() / 1000);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)monotonicMicros();
+}
+
+#endif
@@ -0,0 +1,32 @@
+// Platform.h
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// If you want to collect bus statistics (see UARTServo::getStatistics()), uncomment the following line.
+//#define SERVO_STATISTICS
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#elif defined(ARDUINO)
+#include "WProgram.h"
+#else
+// Host build (e.g. Linux), provide the few Arduino definitions used by this library.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+/*!
+ * Milliseconds elapsed since the first call, from a monotonic clock.
+ */
+unsigned long millis();
+
+/*!
+ * Microseconds elapsed since the first call, from a monotonic clock.
+ */
+unsigned long micros();
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#include "PtyTransport.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+PtyTransport::PtyTransport()
+{
+	_slaveName[0] = '\0';
+}
+
+bool PtyTransport::begin(unsigned long baud)
+{
+	if (_fd < 0)
+	{
+		_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (_fd < 0)
+		{
+			return false;
+		}
+		if (grantpt(_fd) != 0 || unlockpt(_fd) != 0 || ptsname_r(_fd, _slaveName, sizeof(_slaveName)) != 0)
+		{
+			end();
+			_slaveName[0] = '\0';
+			return false;
+		}
+	}
+	return configure(baud);
+}
+
+const char* PtyTransport::getSlaveName() const
+{
+	return _slaveName;
+}
+
+#endif
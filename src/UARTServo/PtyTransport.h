@@ -0,0 +1,37 @@
+// PtyTransport.h
+
+#ifndef PTYTRANSPORT_H
+#define PTYTRANSPORT_H
+
+#include "TermiosTransport.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+/*!
+ * PtyTransport class
+ * Master side of a pseudo terminal. The slave side behaves like a serial device,
+ * so a TermiosTransport (or any other program) opened on getSlaveName() is connected to this transport.
+ * It is mainly used for tests without physical servos.
+ */
+class PtyTransport : public TermiosTransport
+{
+public:
+	PtyTransport();
+
+	/*!
+	 * Create the pseudo terminal, the rate is ignored by the kernel.
+	 */
+	bool begin(unsigned long baud);
+
+	/*!
+	 * Path of the slave device, empty if the transport is not opened.
+	 */
+	const char* getSlaveName() const;
+
+private:
+	char _slaveName[64];
+};
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+// SerialTransport.h
+
+#ifndef SERIALTRANSPORT_H
+#define SERIALTRANSPORT_H
+
+#include "UARTTransport.h"
+
+#ifdef ARDUINO
+
+/*!
+ * SerialTransport class
+ * Transport over an Arduino serial port, T is HardwareSerial or SoftwareSerial.
+ */
+template<class T>
+class SerialTransport : public UARTTransport
+{
+public:
+	SerialTransport() : _serial(NULL) {}
+
+	/*!
+	 * Attach the serial port, it is opened by begin().
+	 *
+	 * \param serial A pointer to the serial port.
+	 */
+	void attach(T* serial)
+	{
+		_serial = serial;
+	}
+
+	bool begin(unsigned long baud)
+	{
+		_serial->begin(baud);
+		return true;
+	}
+
+	void end()
+	{
+		_serial->end();
+	}
+
+	size_t available()
+	{
+		return _serial->available();
+	}
+
+	size_t read(byte* dest, size_t size)
+	{
+		size_t count = _serial->available();
+		if (count > size)
+		{
+			count = size;
+		}
+		// Bytes are already buffered, so readBytes() never waits here.
+		return (count > 0) ? _serial->readBytes(dest, count) : 0;
+	}
+
+	size_t write(const byte* src, size_t size)
+	{
+		return _serial->write(src, size);
+	}
+
+private:
+	T* _serial;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,271 @@
+#include "ServoCoroutine.h"
+
+#if __cplusplus >= 202002L && !defined(ARDUINO)
+
+CoroutinePool::CoroutinePool(void* memory, size_t size, size_t blockSize)
+	: _free(NULL), _blockSize(blockSize), _freeCount(0)
+{
+	// Blocks are whole headers long, so that every frame is aligned like its header.
+	size_t stride = (1 + (blockSize + sizeof(Header) - 1) / sizeof(Header)) * sizeof(Header);
+	uintptr_t start = ((uintptr_t)memory + sizeof(Header) - 1) & ~(uintptr_t)(sizeof(Header) - 1);
+	uintptr_t end = (uintptr_t)memory + size;
+	for (uintptr_t block = start; block + stride <= end; block += stride)
+	{
+		Header* header = (Header*)block;
+		header->next = _free;
+		_free = header;
+		_freeCount++;
+	}
+}
+
+void* CoroutinePool::allocate(size_t size)
+{
+	if (size > _blockSize || _free == NULL)
+	{
+		return NULL;
+	}
+	Header* header = _free;
+	_free = header->next;
+	_freeCount--;
+	header->pool = this;
+	return header + 1;
+}
+
+void CoroutinePool::release(void* block)
+{
+	if (block == NULL)
+	{
+		return;
+	}
+	Header* header = (Header*)block - 1;
+	CoroutinePool* pool = header->pool;
+	header->next = pool->_free;
+	pool->_free = header;
+	pool->_freeCount++;
+}
+
+size_t CoroutinePool::getBlockSize() const
+{
+	return _blockSize;
+}
+
+size_t CoroutinePool::getFree() const
+{
+	return _freeCount;
+}
+
+void ServoRoutine::promise_type::operator delete(void* block)
+{
+	CoroutinePool::release(block);
+}
+
+ServoRoutine::~ServoRoutine()
+{
+	if (!_handle)
+	{
+		return;
+	}
+	if (_handle.done())
+	{
+		_handle.destroy();
+	}
+	else
+	{
+		_handle.promise().detached = true;
+	}
+}
+
+bool ServoRoutine::isValid() const
+{
+	return (bool)_handle;
+}
+
+bool ServoRoutine::isDone() const
+{
+	return !_handle || _handle.done();
+}
+
+void ServoDelay::await_suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	_due = millis() + _time;
+	_next = _bus._delays;
+	_bus._delays = this;
+}
+
+ServoBus::ServoBus(UARTServo& servo)
+	: _servo(servo), _delays(NULL)
+{
+	servo.attach(this);
+}
+
+ServoBus::~ServoBus()
+{
+	_servo.detach(this);
+}
+
+UARTServo& ServoBus::getServo()
+{
+	return _servo;
+}
+
+ServoAwaitable<byte> ServoBus::ping(byte id)
+{
+	return ServoAwaitable<byte>(_servo, PACKET_PING, &id, 1, decodePing);
+}
+
+ServoAwaitable<int> ServoBus::readAngle(byte id)
+{
+	return ServoAwaitable<int>(_servo, PACKET_READ_ANGLE, &id, 1, decodeAngle);
+}
+
+ServoAwaitable<UserParameter> ServoBus::readBatchData(byte id)
+{
+	return ServoAwaitable<UserParameter>(_servo, PACKET_READ_BATCH_DATA, &id, 1, decodeBatchData);
+}
+
+ServoAwaitable<byte> ServoBus::writeBatchData(byte id, const UserParameter& parameter)
+{
+	byte payload[1 + USER_DATA_SIZE];
+	payload[0] = id;
+	encodeUserParameter(&parameter, payload + 1);
+	return ServoAwaitable<byte>(_servo, PACKET_WRITE_BATCH_DATA, payload, sizeof(payload), decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::resetUserData(byte id)
+{
+	return ServoAwaitable<byte>(_servo, PACKET_RESET_USER_DATA, &id, 1, decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::spin(byte id, byte method, unsigned int speed, unsigned int value)
+{
+	SpinFrame frame;
+	encodeSpin(frame, id, method, speed, value);
+	return ServoAwaitable<byte>(_servo, PACKET_SPIN, frame.getPayload(), frame.SIZE, decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::rotate(byte id, int angle, unsigned int interval, unsigned int power)
+{
+	RotateFrame frame;
+	encodeRotate(frame, id, angle, interval, power);
+	return ServoAwaitable<byte>(_servo, PACKET_ROTATE, frame.getPayload(), frame.SIZE, decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power)
+{
+	RotateByIntervalFrame frame;
+	encodeRotateBy(frame, id, angle, interval, accInterval, decInterval, power);
+	return ServoAwaitable<byte>(_servo, PACKET_ROTATE_BY_INTERVAL, frame.getPayload(), frame.SIZE, decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power)
+{
+	RotateByVelocityFrame frame;
+	encodeRotateBy(frame, id, angle, targetVelocity, accInterval, decInterval, power);
+	return ServoAwaitable<byte>(_servo, PACKET_ROTATE_BY_VELOCITY, frame.getPayload(), frame.SIZE, decodeResult);
+}
+
+ServoAwaitable<byte> ServoBus::damping(byte id, unsigned int power)
+{
+	DampingFrame frame;
+	encodeDamping(frame, id, power);
+	return ServoAwaitable<byte>(_servo, PACKET_DAMPING, frame.getPayload(), frame.SIZE, decodeResult);
+}
+
+ServoDelay ServoBus::delay(unsigned long time)
+{
+	return ServoDelay(*this, time);
+}
+
+void ServoBus::poll(UARTServo&, unsigned long now)
+{
+	// A resumed coroutine may add or finish delays, so the search starts over after each one.
+	bool resumed = true;
+	while (resumed)
+	{
+		resumed = false;
+		for (ServoDelay** p = &_delays; *p != NULL; p = &(*p)->_next)
+		{
+			ServoDelay* delay = *p;
+			if ((long)(now - delay->_due) >= 0)
+			{
+				*p = delay->_next;
+				delay->_handle.resume();
+				resumed = true;
+				break;
+			}
+		}
+	}
+}
+
+unsigned long ServoBus::getPollDelay(unsigned long now) const
+{
+	unsigned long delay = POLL_IDLE;
+	for (const ServoDelay* d = _delays; d != NULL; d = d->_next)
+	{
+		long left = (long)(d->_due - now);
+		if (left <= 0)
+		{
+			return 0;
+		}
+		if ((unsigned long)left < delay)
+		{
+			delay = left;
+		}
+	}
+	return delay;
+}
+
+bool ServoBus::decodePing(const byte* payload, byte length, byte* value)
+{
+	if (length < 1)
+	{
+		return false;
+	}
+	*value = payload[0];
+	return true;
+}
+
+bool ServoBus::decodeResult(const byte* payload, byte length, byte* value)
+{
+	// ID and result.
+	if (length < 2)
+	{
+		return false;
+	}
+	*value = payload[1];
+	return true;
+}
+
+bool ServoBus::decodeWriteResult(const byte* payload, byte length, byte* value)
+{
+	// ID, data ID and result.
+	if (length < 3)
+	{
+		return false;
+	}
+	*value = payload[2];
+	return true;
+}
+
+bool ServoBus::decodeAngle(const byte* payload, byte length, int* value)
+{
+	if (length < 3)
+	{
+		return false;
+	}
+	*value = DataWire<2, true>::read<1>(payload);
+	return true;
+}
+
+bool ServoBus::decodeBatchData(const byte* payload, byte length, UserParameter* value)
+{
+	if (length != 1 + USER_DATA_SIZE)
+	{
+		return false;
+	}
+	decodeUserParameter(payload + 1, value);
+	return true;
+}
+
+#endif
@@ -0,0 +1,420 @@
+// ServoCoroutine.h
+
+#ifndef SERVOCOROUTINE_H
+#define SERVOCOROUTINE_H
+
+#include "UARTServo.h"
+
+#if __cplusplus >= 202002L && !defined(ARDUINO)
+
+#include <coroutine>
+
+/// Status of an awaited command: the response arrived, or the request to ALL_SERVOS has been sent.
+#define AWAIT_OK				0
+/// Status of an awaited command: no response after all retries, see UARTServo::setTimeout().
+#define AWAIT_TIMEOUT			1
+/// Status of an awaited command: the pending-request table is full, the request is not sent.
+#define AWAIT_BUSY				2
+/// Status of an awaited command: the response is too short or answers another data ID.
+#define AWAIT_MALFORMED			3
+
+/*!
+ * Result of an awaited command.
+ */
+template<typename T>
+struct ServoResult
+{
+	/// AWAIT_OK, AWAIT_TIMEOUT, AWAIT_BUSY or AWAIT_MALFORMED.
+	byte status;
+	/// The value of the response, only valid with AWAIT_OK.
+	T value;
+
+	bool ok() const
+	{
+		return status == AWAIT_OK;
+	}
+};
+
+/*!
+ * CoroutinePool class
+ * Fixed-size blocks for coroutine frames, carved from memory given by the caller.
+ * A ServoRoutine takes its frame from the pool passed as its first parameter, never from the heap.
+ */
+class CoroutinePool
+{
+public:
+	/*!
+	 * \param memory Memory of the blocks, it must stay valid while the pool is used.
+	 * \param size Size of the memory.
+	 * \param blockSize Largest coroutine frame.
+	 */
+	CoroutinePool(void* memory, size_t size, size_t blockSize);
+
+	/*!
+	 * Take a block.
+	 *
+	 * \param size Size of the coroutine frame.
+	 * \return The block, NULL if the frame is too large or all blocks are taken.
+	 */
+	void* allocate(size_t size);
+
+	/*!
+	 * Give a block back to the pool it was taken from.
+	 */
+	static void release(void* block);
+
+	/// Largest coroutine frame.
+	size_t getBlockSize() const;
+
+	/// Number of free blocks.
+	size_t getFree() const;
+
+private:
+	/// Header in front of each block: the owning pool of a taken block, the next free block of a free one.
+	union Header
+	{
+		CoroutinePool* pool;
+		Header* next;
+		max_align_t align;
+	};
+
+	Header* _free;
+	size_t _blockSize;
+	size_t _freeCount;
+};
+
+/*!
+ * StaticCoroutinePool class
+ * A CoroutinePool holding Count blocks of BlockSize bytes in place.
+ */
+template<size_t BlockSize, size_t Count>
+class StaticCoroutinePool : public CoroutinePool
+{
+public:
+	StaticCoroutinePool()
+		: CoroutinePool(_memory, sizeof(_memory), BlockSize)
+	{
+	}
+
+private:
+	alignas(max_align_t) byte _memory[Count * (BlockSize + 2 * sizeof(max_align_t))];
+};
+
+/*!
+ * ServoRoutine class
+ * Return type of a coroutine driving servos, e.g.
+ *
+ *     ServoRoutine calibrate(CoroutinePool& pool, ServoBus& bus, byte id)
+ *     {
+ *         ServoResult<int> angle = co_await bus.readAngle(id);
+ *         ...
+ *     }
+ *
+ * The coroutine is a free function taking its frame from the CoroutinePool of its first parameter,
+ * a coroutine without one does not compile. It starts at once and runs until its first co_await.
+ * Destroying the ServoRoutine object before the coroutine is finished lets it run on and free its frame at the end.
+ */
+class ServoRoutine
+{
+public:
+	struct promise_type
+	{
+		bool detached = false;
+
+		ServoRoutine get_return_object()
+		{
+			return ServoRoutine(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		static ServoRoutine get_return_object_on_allocation_failure()
+		{
+			return ServoRoutine();
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		/// A detached coroutine does not suspend at the end, so its frame is freed.
+		struct FinalAwaiter
+		{
+			bool detached;
+
+			bool await_ready() const noexcept
+			{
+				return detached;
+			}
+
+			void await_suspend(std::coroutine_handle<>) const noexcept
+			{
+			}
+
+			void await_resume() const noexcept
+			{
+			}
+		};
+
+		FinalAwaiter final_suspend() noexcept
+		{
+			return FinalAwaiter{ detached };
+		}
+
+		void return_void()
+		{
+		}
+
+		void unhandled_exception()
+		{
+		}
+
+		/// The frame comes from the pool, the other parameters of the coroutine are ignored.
+		static void* operator new(size_t size, CoroutinePool& pool, ...) noexcept
+		{
+			return pool.allocate(size);
+		}
+
+		static void operator delete(void* block);
+	};
+
+	ServoRoutine() : _handle(nullptr) {}
+	ServoRoutine(const ServoRoutine&) = delete;
+	ServoRoutine& operator=(const ServoRoutine&) = delete;
+
+	ServoRoutine(ServoRoutine&& other) : _handle(other._handle)
+	{
+		other._handle = nullptr;
+	}
+
+	~ServoRoutine();
+
+	/// Whether the coroutine got a frame from its pool, it did not run otherwise.
+	bool isValid() const;
+
+	/// Whether the coroutine is finished, or never ran.
+	bool isDone() const;
+
+private:
+	std::coroutine_handle<promise_type> _handle;
+
+	explicit ServoRoutine(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+};
+
+/*!
+ * ServoAwaitable class
+ * A request sent when it is awaited, the coroutine resumes on its response or its timeout.
+ */
+template<typename T>
+class ServoAwaitable : public ResponseHandler
+{
+public:
+	/// Decode a response payload, false if it is malformed.
+	typedef bool(*Decoder)(const byte* payload, byte length, T* value);
+
+	ServoAwaitable(UARTServo& servo, byte number, const byte* payload, byte size, Decoder decoder)
+		: _servo(servo), _number(number), _size(size), _decoder(decoder)
+	{
+		memcpy(_payload, payload, size);
+		_result.status = AWAIT_BUSY;
+		_result.value = T();
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		_handle = handle;
+		// Without room for the request, the coroutine goes on at once with AWAIT_BUSY.
+		if (!_servo.sendRequest(_number, _payload, _size, this))
+		{
+			return false;
+		}
+		if (_payload[0] == ALL_SERVOS)
+		{
+			// No servo replies to a broadcast, the coroutine goes on at once with AWAIT_OK.
+			_result.status = AWAIT_OK;
+			return false;
+		}
+		return true;
+	}
+
+	ServoResult<T> await_resume() const
+	{
+		return _result;
+	}
+
+	void onResponse(byte, byte, const byte* payload, byte length)
+	{
+		_result.status = _decoder(payload, length, &_result.value) ? AWAIT_OK : AWAIT_MALFORMED;
+		resume();
+	}
+
+	void onTimeout(byte, byte, byte)
+	{
+		_result.status = AWAIT_TIMEOUT;
+		resume();
+	}
+
+private:
+	UARTServo& _servo;
+	byte _number;
+	byte _size;
+	byte _payload[1 + USER_DATA_SIZE];
+	Decoder _decoder;
+	std::coroutine_handle<> _handle;
+	ServoResult<T> _result;
+
+	void resume()
+	{
+		// The coroutine destroys this object as it goes on, nothing may be touched after this call.
+		std::coroutine_handle<> handle = _handle;
+		handle.resume();
+	}
+};
+
+class ServoBus;
+
+/*!
+ * ServoDelay class
+ * Suspends a coroutine for a while, see ServoBus::delay().
+ */
+class ServoDelay
+{
+public:
+	ServoDelay(ServoBus& bus, unsigned long time) : _bus(bus), _time(time), _next(NULL) {}
+
+	bool await_ready() const noexcept
+	{
+		return _time == 0;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle);
+
+	void await_resume() const
+	{
+	}
+
+private:
+	friend class ServoBus;
+
+	ServoBus& _bus;
+	unsigned long _time;
+	unsigned long _due;
+	std::coroutine_handle<> _handle;
+	ServoDelay* _next;
+};
+
+/*!
+ * ServoBus class
+ * Awaitable form of the commands of a UARTServo object, for coroutines returning ServoRoutine:
+ *
+ *     ServoResult<int> angle = co_await bus.readAngle(3);
+ *
+ * Each command resumes the coroutine from UARTServo::update(), with the value of the response,
+ * or with AWAIT_TIMEOUT after the timeout and retries set by UARTServo::setTimeout().
+ * Many coroutines can wait at the same time, up to the size of the pending-request table.
+ * A coroutine must not be destroyed while it waits for a command.
+ */
+class ServoBus : public UARTServoTask
+{
+public:
+	/*!
+	 * \param servo The UARTServo object, this object is attached to it for delay().
+	 */
+	ServoBus(UARTServo& servo);
+	~ServoBus();
+
+	UARTServo& getServo();
+
+	/// Detect status of a servo, the value is the servo ID.
+	ServoAwaitable<byte> ping(byte id);
+
+	/// Read the angle of a servo(unit: 0.1 degree).
+	ServoAwaitable<int> readAngle(byte id);
+
+	/*!
+	 * Read data of a servo, decoded to the value type of the data ID.
+	 */
+	template<DataId Id>
+	ServoAwaitable<typename DataTraits<Id>::Type> readData(byte id)
+	{
+		byte payload[2] = { id, (byte)Id };
+		return ServoAwaitable<typename DataTraits<Id>::Type>(_servo, PACKET_READ_DATA, payload, sizeof(payload), decodeData<Id>);
+	}
+
+	/*!
+	 * Write data to a servo, the value is the result(1:success, 0:fail).
+	 */
+	template<DataId Id>
+	ServoAwaitable<byte> writeData(byte id, typename DataTraits<Id>::Type value)
+	{
+		byte payload[2 + DataTraits<Id>::SIZE] = { id, (byte)Id };
+		DataTraits<Id>::template write<2>(payload, value);
+		return ServoAwaitable<byte>(_servo, PACKET_WRITE_DATA, payload, sizeof(payload), decodeWriteResult);
+	}
+
+	/// Read the user data of a servo.
+	ServoAwaitable<UserParameter> readBatchData(byte id);
+
+	/// Write the user data of a servo, the value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> writeBatchData(byte id, const UserParameter& parameter);
+
+	/// Reset the user data of a servo, see UARTServo::resetUserData(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> resetUserData(byte id);
+
+	/// Spin a servo, see UARTServo::spin(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> spin(byte id, byte method, unsigned int speed = 0, unsigned int value = 0);
+
+	/// Rotate a servo, see UARTServo::rotate(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> rotate(byte id, int angle, unsigned int interval, unsigned int power = 0);
+
+	/// Rotate a servo by intervals, see UARTServo::rotateByInterval(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0);
+
+	/// Rotate a servo by velocity, see UARTServo::rotateByVelocity(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0);
+
+	/// Damp a servo, see UARTServo::damping(). The value is the result(1:success, 0:fail).
+	ServoAwaitable<byte> damping(byte id, unsigned int power = 0);
+
+	/*!
+	 * Suspend the coroutine for a while, e.g. to let a servo settle.
+	 *
+	 * \param time Time to wait(unit: millisecond).
+	 */
+	ServoDelay delay(unsigned long time);
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+
+private:
+	friend class ServoDelay;
+
+	UARTServo& _servo;
+	ServoDelay* _delays;
+
+	static bool decodePing(const byte* payload, byte length, byte* value);
+	static bool decodeResult(const byte* payload, byte length, byte* value);
+	static bool decodeWriteResult(const byte* payload, byte length, byte* value);
+	static bool decodeAngle(const byte* payload, byte length, int* value);
+	static bool decodeBatchData(const byte* payload, byte length, UserParameter* value);
+
+	template<DataId Id>
+	static bool decodeData(const byte* payload, byte length, typename DataTraits<Id>::Type* value)
+	{
+		// ID, data ID and the value, decoded in place.
+		if (length != 2 + DataTraits<Id>::SIZE || payload[1] != (byte)Id)
+		{
+			return false;
+		}
+		*value = DataTraits<Id>::template read<2>(payload);
+		return true;
+	}
+};
+
+#endif
+
+#endif
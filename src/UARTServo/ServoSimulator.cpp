@@ -0,0 +1,555 @@
+#include "ServoSimulator.h"
+
+#ifndef ARDUINO
+
+#include <math.h>
+#include <stdlib.h>
+
+#define READ_CHUNK_SIZE		256
+
+static void setUserData(VirtualServo* servo, byte dataID, unsigned int value)
+{
+	byte offset, width;
+	if (getUserDataField(dataID, &offset, &width))
+	{
+		servo->userData[offset] = (byte)value;
+		if (width == 2)
+		{
+			servo->userData[offset + 1] = (byte)(value >> 8);
+		}
+	}
+}
+
+ServoSimulator::ServoSimulator()
+	: _transport(NULL), _parser(REQUEST_HEADER), _servoCount(0), _replyCount(0),
+	_minLatency(0), _maxLatency(0), _byteLoss(0), _corruption(0), _seed(1), _requests(0)
+{
+}
+
+bool ServoSimulator::begin(UARTTransport* transport, unsigned long baud)
+{
+	_transport = transport;
+	_parser.reset();
+	return _transport->begin(baud);
+}
+
+VirtualServo* ServoSimulator::addServo(byte id)
+{
+	if (_servoCount >= SIMULATOR_SERVOS)
+	{
+		return NULL;
+	}
+	VirtualServo* servo = &_servos[_servoCount++];
+	memset(servo, 0, sizeof(VirtualServo));
+	servo->id = id;
+	servo->mode = VirtualServo::IDLE;
+	resetUserData(servo);
+	return servo;
+}
+
+VirtualServo* ServoSimulator::getServo(byte id)
+{
+	for (byte i = 0; i < _servoCount; i++)
+	{
+		if (_servos[i].id == id)
+		{
+			return &_servos[i];
+		}
+	}
+	return NULL;
+}
+
+byte ServoSimulator::getServoCount() const
+{
+	return _servoCount;
+}
+
+void ServoSimulator::setLatency(unsigned long minMicros, unsigned long maxMicros)
+{
+	_minLatency = minMicros;
+	_maxLatency = (maxMicros > minMicros) ? maxMicros : minMicros;
+}
+
+void ServoSimulator::setByteLoss(double probability)
+{
+	_byteLoss = probability;
+}
+
+void ServoSimulator::setCorruption(double probability)
+{
+	_corruption = probability;
+}
+
+void ServoSimulator::setSeed(unsigned int seed)
+{
+	_seed = seed;
+}
+
+unsigned long ServoSimulator::getRequestCount() const
+{
+	return _requests;
+}
+
+void ServoSimulator::update()
+{
+	update(micros());
+}
+
+void ServoSimulator::update(unsigned long now)
+{
+	byte chunk[READ_CHUNK_SIZE];
+	size_t count;
+	while ((count = _transport->read(chunk, sizeof(chunk))) > 0)
+	{
+		const byte* data = chunk;
+		while (count > 0)
+		{
+			size_t used = _parser.parse(data, count);
+			if (_parser.isComplete())
+			{
+				handleRequest(_parser.getNumber(), _parser.getPayload(), _parser.getLength(), now);
+			}
+			data += used;
+			count -= used;
+		}
+	}
+
+	for (byte i = 0; i < _servoCount; i++)
+	{
+		move(&_servos[i], now);
+	}
+	flush(now);
+}
+
+double ServoSimulator::random()
+{
+	return (double)rand_r(&_seed) / ((double)RAND_MAX + 1.0);
+}
+
+void ServoSimulator::resetUserData(VirtualServo* servo)
+{
+	memset(servo->userData, 0, sizeof(servo->userData));
+	setUserData(servo, 32, 1);
+	setUserData(servo, 34, servo->id);
+	setUserData(servo, 36, 0x05);
+	setUserData(servo, 37, 1);
+	setUserData(servo, 39, 4500);
+	setUserData(servo, 40, 14000);
+	setUserData(servo, 41, 65);
+	setUserData(servo, 42, 12000);
+	setUserData(servo, 43, 3000);
+	setUserData(servo, 51, (unsigned int)1800);
+	setUserData(servo, 52, (unsigned int)-1800);
+}
+
+unsigned int ServoSimulator::getUserData(const VirtualServo* servo, byte dataID) const
+{
+	byte offset, width;
+	if (!getUserDataField(dataID, &offset, &width))
+	{
+		return 0;
+	}
+	unsigned int value = servo->userData[offset];
+	if (width == 2)
+	{
+		value |= (unsigned int)servo->userData[offset + 1] << 8;
+	}
+	return value;
+}
+
+void ServoSimulator::handleRequest(byte number, const byte* payload, byte length, unsigned long now)
+{
+	if (length == 0)
+	{
+		return;
+	}
+	_requests++;
+	byte id = payload[0];
+	if (id == ALL_SERVOS)
+	{
+		// Every servo executes a broadcast, none of them answers so that replies do not collide.
+		for (byte i = 0; i < _servoCount; i++)
+		{
+			FrameReader reader(payload + 1, length - 1);
+			handleServoRequest(&_servos[i], number, reader, false, now);
+		}
+		return;
+	}
+	VirtualServo* servo = getServo(id);
+	if (servo != NULL)
+	{
+		FrameReader reader(payload + 1, length - 1);
+		handleServoRequest(servo, number, reader, true, now);
+	}
+}
+
+void ServoSimulator::handleServoRequest(VirtualServo* servo, byte number, FrameReader& reader, bool reply, unsigned long now)
+{
+	byte response[USER_DATA_SIZE + 1];
+	FrameWriter frame(response, sizeof(response));
+	byte id = servo->id;
+	// Motions are acknowledged right away, or when completed if the servo is responsive.
+	bool responsive = getUserData(servo, 33) != 0;
+	move(servo, now);
+
+	switch (number)
+	{
+		case PACKET_PING:
+		{
+			frame.write(id);
+			break;
+		}
+		case PACKET_RESET_USER_DATA:
+		{
+			resetUserData(servo);
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_READ_DATA:
+		{
+			byte dataID = reader.read();
+			frame.write(id);
+			frame.write(dataID);
+			if (!readData(servo, dataID, frame))
+			{
+				return;
+			}
+			break;
+		}
+		case PACKET_WRITE_DATA:
+		{
+			byte dataID = reader.read();
+			frame.write(id);
+			frame.write(dataID);
+			frame.write(writeData(servo, dataID, reader) ? 1 : 0);
+			break;
+		}
+		case PACKET_READ_BATCH_DATA:
+		{
+			frame.write(id);
+			frame.write(servo->userData, USER_DATA_SIZE);
+			break;
+		}
+		case PACKET_WRITE_BATCH_DATA:
+		{
+			bool result = reader.getRemaining() == USER_DATA_SIZE;
+			if (result)
+			{
+				reader.read(servo->userData, USER_DATA_SIZE);
+				servo->id = servo->userData[2];
+			}
+			frame.write(id);
+			frame.write(result ? 1 : 0);
+			break;
+		}
+		case PACKET_SPIN:
+		{
+			byte method = reader.read();
+			unsigned int speed = reader.readUInt();
+			unsigned int value = reader.readUInt();
+			byte behavior = method & 0x0f;
+			if (behavior == SPIN_STOP || speed == 0)
+			{
+				servo->mode = VirtualServo::IDLE;
+			}
+			else
+			{
+				servo->mode = VirtualServo::SPIN;
+				// degree/sec. to 0.1 degree per millisecond.
+				servo->spinVelocity = ((method & SPIN_CLOCKWISE) ? 1 : -1) * speed / 100.0;
+				servo->spinTime = 0;
+				if (behavior == SPIN_BY_CYCLE)
+				{
+					servo->spinTime = value * 3600.0 / fabs(servo->spinVelocity);
+				}
+				else if (behavior == SPIN_BY_TIME)
+				{
+					servo->spinTime = value;
+				}
+				servo->startAngle = servo->angle;
+				servo->motionStart = now;
+			}
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_ROTATE:
+		{
+			int angle = reader.readInt();
+			unsigned int interval = reader.readUInt();
+			servo->power = reader.readUInt();
+			startRotation(servo, angle, 0, interval, 0, 0, now);
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_ROTATE_BY_INTERVAL:
+		{
+			int angle = reader.readInt();
+			double interval = reader.readUInt();
+			double accInterval = reader.readUInt();
+			double decInterval = reader.readUInt();
+			servo->power = reader.readUInt();
+			if (accInterval + decInterval > interval)
+			{
+				double scale = interval / (accInterval + decInterval);
+				accInterval *= scale;
+				decInterval *= scale;
+			}
+			startRotation(servo, angle, accInterval, interval - accInterval - decInterval, decInterval, 0, now);
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_ROTATE_BY_VELOCITY:
+		{
+			int angle = reader.readInt();
+			unsigned int velocity = reader.readUInt();
+			double accInterval = reader.readUInt();
+			double decInterval = reader.readUInt();
+			servo->power = reader.readUInt();
+			// degree/sec. to 0.1 degree per millisecond, the cruise time follows from the distance.
+			startRotation(servo, angle, accInterval, -1, decInterval, velocity / 100.0, now);
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_DAMPING:
+		{
+			servo->power = reader.readUInt();
+			servo->mode = VirtualServo::DAMPING;
+			frame.write(id);
+			frame.write(1);
+			break;
+		}
+		case PACKET_READ_ANGLE:
+		{
+			frame.write(id);
+			frame.writeInt((int)lround(servo->angle));
+			break;
+		}
+		default:
+		{
+			return;
+		}
+	}
+
+	bool motion = number == PACKET_ROTATE || number == PACKET_ROTATE_BY_INTERVAL || number == PACKET_ROTATE_BY_VELOCITY
+		|| (number == PACKET_SPIN && servo->mode == VirtualServo::SPIN && servo->spinTime > 0);
+	if (motion && responsive)
+	{
+		servo->completion = number;
+	}
+	else if (reply)
+	{
+		this->reply(number, frame.getData(), frame.getLength(), now);
+	}
+}
+
+void ServoSimulator::startRotation(VirtualServo* servo, int target, double accTime, double cruiseTime, double decTime, double velocity, unsigned long now)
+{
+	if (getUserData(servo, 48) != 0)
+	{
+		int upper = (int16_t)getUserData(servo, 51);
+		int lower = (int16_t)getUserData(servo, 52);
+		target = (target > upper) ? upper : ((target < lower) ? lower : target);
+	}
+
+	servo->mode = VirtualServo::ROTATE;
+	servo->startAngle = servo->angle;
+	servo->distance = target - servo->angle;
+	servo->motionStart = now;
+
+	double distance = fabs(servo->distance);
+	if (cruiseTime < 0)
+	{
+		// Velocity given, find the cruise time, or lower the peak if the distance is too short.
+		if (velocity <= 0)
+		{
+			velocity = 1;
+		}
+		cruiseTime = distance / velocity - (accTime + decTime) / 2;
+		if (cruiseTime < 0)
+		{
+			cruiseTime = 0;
+			velocity = (accTime + decTime > 0) ? distance * 2 / (accTime + decTime) : velocity;
+		}
+	}
+	else
+	{
+		double span = cruiseTime + (accTime + decTime) / 2;
+		velocity = (span > 0) ? distance / span : 0;
+	}
+	servo->accTime = accTime;
+	servo->cruiseTime = cruiseTime;
+	servo->decTime = decTime;
+	servo->peakVelocity = velocity;
+}
+
+void ServoSimulator::move(VirtualServo* servo, unsigned long now)
+{
+	double t = (now - servo->motionStart) / 1000.0;
+	bool completed = false;
+
+	if (servo->mode == VirtualServo::ROTATE)
+	{
+		double v = servo->peakVelocity;
+		double ta = servo->accTime;
+		double tc = servo->cruiseTime;
+		double td = servo->decTime;
+		double s;
+		if (t >= ta + tc + td)
+		{
+			s = fabs(servo->distance);
+			completed = true;
+		}
+		else if (t < ta)
+		{
+			s = 0.5 * v / ta * t * t;
+		}
+		else if (t < ta + tc)
+		{
+			s = 0.5 * v * ta + v * (t - ta);
+		}
+		else
+		{
+			double u = t - ta - tc;
+			s = 0.5 * v * ta + v * tc + v * u - 0.5 * v / td * u * u;
+		}
+		servo->angle = servo->startAngle + ((servo->distance < 0) ? -s : s);
+		if (completed)
+		{
+			servo->mode = VirtualServo::IDLE;
+		}
+	}
+	else if (servo->mode == VirtualServo::SPIN)
+	{
+		if (servo->spinTime > 0 && t >= servo->spinTime)
+		{
+			t = servo->spinTime;
+			completed = true;
+			servo->mode = VirtualServo::IDLE;
+		}
+		// Keep the angle in [-180, 180) degrees.
+		double angle = fmod(servo->startAngle + servo->spinVelocity * t + 1800, 3600);
+		servo->angle = ((angle < 0) ? angle + 3600 : angle) - 1800;
+	}
+
+	if (completed && servo->completion != 0)
+	{
+		byte payload[2] = { servo->id, 1 };
+		reply(servo->completion, payload, 2, now);
+		servo->completion = 0;
+	}
+}
+
+bool ServoSimulator::readData(VirtualServo* servo, byte dataID, FrameWriter& frame)
+{
+	bool moving = servo->mode == VirtualServo::SPIN || servo->mode == VirtualServo::ROTATE;
+	unsigned int voltage = moving ? 7300 : 7400;
+	unsigned int current = moving ? 600 : 50;
+	switch (dataID)
+	{
+		case 1: frame.writeUInt(voltage); return true;
+		case 2: frame.writeUInt(current); return true;
+		case 3: frame.writeUInt((unsigned int)((unsigned long)voltage * current / 1000)); return true;
+		case 4: frame.writeUInt(moving ? 38 : 35); return true;
+		case 5: frame.write(moving ? 0x01 : 0x00); return true;
+		case 6: frame.writeUInt(0x0001); return true;
+		case 7: frame.writeUInt(0x0100); return true;
+		case 8:
+		{
+			unsigned long serial = 0x10000000UL + servo->id;
+			frame.writeUInt((unsigned int)(serial & 0xffff));
+			frame.writeUInt((unsigned int)(serial >> 16));
+			return true;
+		}
+	}
+	byte offset, width;
+	if (!getUserDataField(dataID, &offset, &width))
+	{
+		return false;
+	}
+	frame.write(servo->userData + offset, width);
+	return true;
+}
+
+bool ServoSimulator::writeData(VirtualServo* servo, byte dataID, FrameReader& reader)
+{
+	byte offset, width;
+	if (!getUserDataField(dataID, &offset, &width) || reader.getRemaining() != width)
+	{
+		return false;
+	}
+	reader.read(servo->userData + offset, width);
+	if (dataID == 34)
+	{
+		// The response still carries the old ID, it is built before this call.
+		servo->id = servo->userData[offset];
+	}
+	return true;
+}
+
+void ServoSimulator::reply(byte number, const byte* payload, byte size, unsigned long now)
+{
+	if (_replyCount >= SIMULATOR_REPLIES)
+	{
+		return;
+	}
+	Reply* reply = &_replies[_replyCount++];
+	unsigned long latency = _minLatency;
+	if (_maxLatency > _minLatency)
+	{
+		latency += (unsigned long)(random() * (_maxLatency - _minLatency + 1));
+	}
+	reply->due = now + latency;
+	FrameWriter frame(reply->data, sizeof(reply->data));
+	frame.begin(RESPONSE_HEADER, number, size);
+	frame.write(payload, size);
+	reply->length = frame.end();
+}
+
+void ServoSimulator::flush(unsigned long now)
+{
+	while (_replyCount > 0)
+	{
+		// Send the earliest due reply first, one frame at a time like a half-duplex bus.
+		unsigned int earliest = 0;
+		for (unsigned int i = 1; i < _replyCount; i++)
+		{
+			if ((long)(_replies[i].due - _replies[earliest].due) < 0)
+			{
+				earliest = i;
+			}
+		}
+		Reply* reply = &_replies[earliest];
+		if ((long)(now - reply->due) < 0)
+		{
+			break;
+		}
+
+		byte data[sizeof(reply->data)];
+		byte length = 0;
+		for (byte i = 0; i < reply->length; i++)
+		{
+			if (_byteLoss > 0 && random() < _byteLoss)
+			{
+				continue;
+			}
+			byte value = reply->data[i];
+			if (_corruption > 0 && random() < _corruption)
+			{
+				value ^= (byte)(1 << (rand_r(&_seed) & 7));
+			}
+			data[length++] = value;
+		}
+		_transport->write(data, length);
+
+		// Keep the order of the remaining replies.
+		memmove(reply, reply + 1, (_replyCount - earliest - 1) * sizeof(Reply));
+		_replyCount--;
+	}
+}
+
+#endif
@@ -0,0 +1,165 @@
+// ServoSimulator.h
+
+#ifndef SERVOSIMULATOR_H
+#define SERVOSIMULATOR_H
+
+#include "UARTServo.h"
+
+#ifndef ARDUINO
+
+/// Maximum number of virtual servos.
+#ifndef SIMULATOR_SERVOS
+#define SIMULATOR_SERVOS		64
+#endif
+
+/// Maximum number of responses waiting for their reply latency.
+#ifndef SIMULATOR_REPLIES
+#define SIMULATOR_REPLIES		256
+#endif
+
+/// State of a virtual servo.
+struct VirtualServo
+{
+	enum Mode
+	{
+		IDLE,
+		SPIN,
+		ROTATE,
+		DAMPING
+	};
+
+	byte id;
+	byte mode;
+	/// Current angle(unit: 0.1 degree), updated by ServoSimulator::update().
+	double angle;
+
+	/// Rotation profile, a trapezoid of acceleration, cruise and deceleration phases(unit: millisecond).
+	double startAngle;
+	double distance;
+	double accTime;
+	double cruiseTime;
+	double decTime;
+	/// Peak velocity(unit: 0.1 degree per millisecond).
+	double peakVelocity;
+	/// Spin velocity(unit: 0.1 degree per millisecond), signed.
+	double spinVelocity;
+	/// Spin duration(unit: millisecond), zero to spin forever.
+	double spinTime;
+	unsigned long motionStart;
+
+	/// Packet number of the motion to acknowledge when it is completed, zero if none.
+	byte completion;
+	unsigned int power;
+
+	/// User data area (IDs 32-53) in wire layout.
+	byte userData[USER_DATA_SIZE];
+};
+
+/*!
+ * ServoSimulator class
+ * A virtual servo bus speaking the same protocol as the real servos:
+ * it parses request frames from a transport and answers with response frames.
+ * Angles follow a trapezoidal motion profile, and replies can be delayed, lost or corrupted
+ * to reproduce timing bugs.
+ *
+ * Connect it to a UARTServo object with a pair of LoopbackTransport objects, or give it a PtyTransport
+ * and open a TermiosTransport on the slave device. Call update() regularly, e.g. next to UARTServo::update()
+ * or in a thread of its own.
+ */
+class ServoSimulator
+{
+public:
+	ServoSimulator();
+
+	/*!
+	 * \param transport Bus side transport, it must stay valid while the simulator runs.
+	 * \return true if the transport is opened.
+	 */
+	bool begin(UARTTransport* transport, unsigned long baud = BAUD_RATE);
+
+	/*!
+	 * Add a virtual servo with default user data.
+	 *
+	 * \return The servo, NULL if there is no room.
+	 */
+	VirtualServo* addServo(byte id);
+
+	/*!
+	 * Find a virtual servo.
+	 *
+	 * \return The servo, NULL if no servo has this ID.
+	 */
+	VirtualServo* getServo(byte id);
+
+	byte getServoCount() const;
+
+	/*!
+	 * Delay each response by a random time in [minMicros, maxMicros].
+	 */
+	void setLatency(unsigned long minMicros, unsigned long maxMicros);
+
+	/*!
+	 * Drop each response byte with the given probability.
+	 */
+	void setByteLoss(double probability);
+
+	/*!
+	 * Flip a random bit of each response byte with the given probability.
+	 */
+	void setCorruption(double probability);
+
+	/*!
+	 * Seed the random generator, the same seed replays the same faults.
+	 */
+	void setSeed(unsigned int seed);
+
+	/// Number of requests handled.
+	unsigned long getRequestCount() const;
+
+	/*!
+	 * Handle received requests, move the servos and send the due responses.
+	 */
+	void update();
+
+	/*!
+	 * Same as update(), at a given time(unit: micro second).
+	 */
+	void update(unsigned long now);
+
+private:
+	struct Reply
+	{
+		unsigned long due;
+		byte length;
+		byte data[USER_DATA_SIZE + 1 + FRAME_OVERHEAD];
+	};
+
+	UARTTransport* _transport;
+	FrameParser _parser;
+	VirtualServo _servos[SIMULATOR_SERVOS];
+	byte _servoCount;
+	Reply _replies[SIMULATOR_REPLIES];
+	unsigned int _replyCount;
+	unsigned long _minLatency;
+	unsigned long _maxLatency;
+	double _byteLoss;
+	double _corruption;
+	unsigned int _seed;
+	unsigned long _requests;
+
+	double random();
+	void resetUserData(VirtualServo* servo);
+	void handleRequest(byte number, const byte* payload, byte length, unsigned long now);
+	void handleServoRequest(VirtualServo* servo, byte number, FrameReader& reader, bool reply, unsigned long now);
+	void startRotation(VirtualServo* servo, int target, double accTime, double cruiseTime, double decTime, double velocity, unsigned long now);
+	void move(VirtualServo* servo, unsigned long now);
+	bool readData(VirtualServo* servo, byte dataID, FrameWriter& frame);
+	bool writeData(VirtualServo* servo, byte dataID, FrameReader& reader);
+	unsigned int getUserData(const VirtualServo* servo, byte dataID) const;
+	void reply(byte number, const byte* payload, byte size, unsigned long now);
+	void flush(unsigned long now);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+#include "ServoSnapshot.h"
+
+// Data ID read for each field, the angle has its own command.
+static const byte FIELD_DATA_IDS[SNAPSHOT_FIELDS] =
+{
+	0,
+	(byte)DataId::Status,
+	(byte)DataId::Voltage,
+	(byte)DataId::Current,
+	(byte)DataId::Power,
+	(byte)DataId::Temperature
+};
+
+ServoSnapshot::ServoSnapshot()
+	: _count(0), _fields((1 << SNAPSHOT_ANGLE) | (1 << SNAPSHOT_STATUS)), _period(SNAPSHOT_PERIOD), _maxInFlight(4), _overruns(0),
+	_sequence(0), _started(false), _sweeping(false), _due(0), _field(0), _next(0), _inFlight(0), _blocked(false)
+{
+	_buffers[0].count = 0;
+	_buffers[1].count = 0;
+}
+
+int ServoSnapshot::add(byte id)
+{
+	if (_count >= SNAPSHOT_SERVOS)
+	{
+		return -1;
+	}
+	_ids[_count] = id;
+	return _count++;
+}
+
+void ServoSnapshot::clear()
+{
+	_count = 0;
+}
+
+void ServoSnapshot::setFields(byte fields)
+{
+	_fields = fields | (1 << SNAPSHOT_ANGLE);
+}
+
+void ServoSnapshot::setPeriod(unsigned long period)
+{
+	_period = period;
+}
+
+void ServoSnapshot::setMaxInFlight(byte count)
+{
+	_maxInFlight = count;
+}
+
+bool ServoSnapshot::read(StateSnapshot* snapshot) const
+{
+#ifdef ARDUINO
+	// Sweeps and readers share the loop, a copy never overlaps a publish.
+	if (_sequence == 0)
+	{
+		return false;
+	}
+	*snapshot = _buffers[_sequence & 1];
+	return true;
+#else
+	for (;;)
+	{
+		unsigned long sequence = _sequence.load(std::memory_order_acquire);
+		if (sequence == 0)
+		{
+			return false;
+		}
+		memcpy(snapshot, &_buffers[sequence & 1], sizeof(StateSnapshot));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// The buffer is only rewritten after the next publish, an unchanged number means the copy is whole.
+		if (_sequence.load(std::memory_order_relaxed) == sequence)
+		{
+			return true;
+		}
+	}
+#endif
+}
+
+unsigned long ServoSnapshot::getSweep() const
+{
+#ifdef ARDUINO
+	return _sequence;
+#else
+	return _sequence.load(std::memory_order_acquire);
+#endif
+}
+
+unsigned long ServoSnapshot::getOverruns() const
+{
+	return _overruns;
+}
+
+void ServoSnapshot::poll(UARTServo& servo, unsigned long now)
+{
+	if (!_started)
+	{
+		// The cadence starts from the first poll, a fixed origin may be more than half the clock range away.
+		_started = true;
+		_due = now;
+	}
+	if (_sweeping && (long)(now - _due) >= 0)
+	{
+		// The period is over, publish the sweep without the missing fields.
+		cancel(servo);
+		_overruns++;
+		publish();
+	}
+	if (!_sweeping)
+	{
+		if (_count == 0 || (long)(now - _due) < 0)
+		{
+			return;
+		}
+		begin(now);
+	}
+	send(servo);
+	if (_sweeping && _field >= SNAPSHOT_FIELDS && _inFlight == 0)
+	{
+		publish();
+	}
+}
+
+unsigned long ServoSnapshot::getPollDelay(unsigned long now) const
+{
+	if (_sweeping && _field < SNAPSHOT_FIELDS && _inFlight < _maxInFlight && !_blocked)
+	{
+		return 0;
+	}
+	if (!_sweeping && _count == 0)
+	{
+		return POLL_IDLE;
+	}
+	if (!_started)
+	{
+		return 0;
+	}
+	// The next sweep, or the end of the period of this one.
+	long left = (long)(_due - now);
+	return (left > 0) ? left : 0;
+}
+
+void ServoSnapshot::onResponse(byte id, byte number, const byte* payload, byte length)
+{
+	int field = findField(number, (length >= 2) ? payload[1] : 0);
+	if (field < 0)
+	{
+		return;
+	}
+	// ID and the angle, or ID, data ID and the value.
+	byte size = (field == SNAPSHOT_ANGLE) ? 2 : getDataSize(FIELD_DATA_IDS[field]);
+	byte offset = (field == SNAPSHOT_ANGLE) ? 1 : 2;
+	if (length != offset + size)
+	{
+		// A malformed value counts as a missing one.
+		complete(id, field, false, 0);
+	}
+	else if (field == SNAPSHOT_ANGLE)
+	{
+		complete(id, field, true, DataWire<2, true>::read<1>(payload));
+	}
+	else
+	{
+		complete(id, field, true, (size == 1) ? payload[2] : (long)DataWire<2, false>::read<2>(payload));
+	}
+}
+
+void ServoSnapshot::onTimeout(byte id, byte number, byte argument)
+{
+	int field = findField(number, argument);
+	if (field >= 0)
+	{
+		complete(id, field, false, 0);
+	}
+}
+
+int ServoSnapshot::findField(byte number, byte dataID)
+{
+	if (number == PACKET_READ_ANGLE)
+	{
+		return SNAPSHOT_ANGLE;
+	}
+	for (byte field = SNAPSHOT_STATUS; field < SNAPSHOT_FIELDS; field++)
+	{
+		if (FIELD_DATA_IDS[field] == dataID)
+		{
+			return field;
+		}
+	}
+	return -1;
+}
+
+StateSnapshot& ServoSnapshot::getBack()
+{
+#ifdef ARDUINO
+	return _buffers[(_sequence + 1) & 1];
+#else
+	return _buffers[(_sequence.load(std::memory_order_relaxed) + 1) & 1];
+#endif
+}
+
+void ServoSnapshot::begin(unsigned long now)
+{
+#ifdef ARDUINO
+	unsigned long sequence = _sequence;
+#else
+	unsigned long sequence = _sequence.load(std::memory_order_relaxed);
+	// The back buffer is the one readers of the previous snapshot may still copy, they see the next publish.
+	std::atomic_thread_fence(std::memory_order_release);
+#endif
+	const StateSnapshot& front = _buffers[sequence & 1];
+	StateSnapshot& back = _buffers[(sequence + 1) & 1];
+	back.start = micros();
+	back.end = 0;
+	back.count = _count;
+	for (byte i = 0; i < _count; i++)
+	{
+		ServoState* state = &back.servos[i];
+		if (sequence > 0 && i < front.count && front.servos[i].id == _ids[i])
+		{
+			*state = front.servos[i];
+		}
+		else
+		{
+			memset(state, 0, sizeof(ServoState));
+			state->id = _ids[i];
+		}
+		state->fresh = 0;
+		_pending[i] = 0;
+	}
+	_field = 0;
+	_next = 0;
+	_inFlight = 0;
+	_sweeping = true;
+
+	// Keep the cadence even if a sweep is late.
+	_due += _period;
+	if ((long)(now - _due) >= 0)
+	{
+		_due = now + _period;
+	}
+}
+
+void ServoSnapshot::send(UARTServo& servo)
+{
+	const StateSnapshot& back = getBack();
+	_blocked = false;
+	while (_field < SNAPSHOT_FIELDS && _inFlight < _maxInFlight)
+	{
+		if ((_fields & (1 << _field)) == 0 || _next >= back.count)
+		{
+			_field++;
+			_next = 0;
+			continue;
+		}
+		byte payload[2] = { back.servos[_next].id, FIELD_DATA_IDS[_field] };
+		bool sent = (_field == SNAPSHOT_ANGLE)
+			? servo.sendRequest(PACKET_READ_ANGLE, payload, 1, this)
+			: servo.sendRequest(PACKET_READ_DATA, payload, 2, this);
+		if (!sent)
+		{
+			// The pending-request table is full, try again after a response or a request deadline.
+			_blocked = true;
+			break;
+		}
+		_pending[_next] |= 1 << _field;
+		_inFlight++;
+		_next++;
+	}
+}
+
+void ServoSnapshot::cancel(UARTServo& servo)
+{
+	const StateSnapshot& back = getBack();
+	for (byte i = 0; i < back.count; i++)
+	{
+		for (byte field = 0; field < SNAPSHOT_FIELDS; field++)
+		{
+			if ((_pending[i] & (1 << field)) != 0)
+			{
+				servo.cancelRequest(back.servos[i].id, (field == SNAPSHOT_ANGLE) ? PACKET_READ_ANGLE : PACKET_READ_DATA, this);
+			}
+		}
+		_pending[i] = 0;
+	}
+	_inFlight = 0;
+}
+
+void ServoSnapshot::publish()
+{
+	StateSnapshot& back = getBack();
+	back.end = micros();
+#ifdef ARDUINO
+	back.sweep = _sequence + 1;
+	_sequence++;
+#else
+	back.sweep = _sequence.load(std::memory_order_relaxed) + 1;
+	_sequence.store(back.sweep, std::memory_order_release);
+#endif
+	_sweeping = false;
+}
+
+void ServoSnapshot::complete(byte id, byte field, bool received, long value)
+{
+	if (!_sweeping)
+	{
+		return;
+	}
+	StateSnapshot& back = getBack();
+	for (byte i = 0; i < back.count; i++)
+	{
+		if (back.servos[i].id == id && (_pending[i] & (1 << field)) != 0)
+		{
+			_pending[i] &= ~(1 << field);
+			_inFlight--;
+			if (received)
+			{
+				back.servos[i].values[field] = value;
+				back.servos[i].times[field] = micros();
+				back.servos[i].fresh |= 1 << field;
+			}
+			if (_field >= SNAPSHOT_FIELDS && _inFlight == 0)
+			{
+				publish();
+			}
+			return;
+		}
+	}
+}
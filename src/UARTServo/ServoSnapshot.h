@@ -0,0 +1,178 @@
+// ServoSnapshot.h
+
+#ifndef SERVOSNAPSHOT_H
+#define SERVOSNAPSHOT_H
+
+#include "UARTServo.h"
+
+#ifndef ARDUINO
+#include <atomic>
+#endif
+
+/// Maximum number of servos in a snapshot.
+#ifndef SNAPSHOT_SERVOS
+#ifdef ARDUINO
+#define SNAPSHOT_SERVOS			8
+#else
+#define SNAPSHOT_SERVOS			32
+#endif
+#endif
+
+/// Default sweep period(unit: millisecond).
+#define SNAPSHOT_PERIOD			20
+
+/// Field of a snapshot: the current angle(unit: 0.1 degree), always swept.
+#define SNAPSHOT_ANGLE			0
+/// Field of a snapshot: the status byte(data ID 5).
+#define SNAPSHOT_STATUS			1
+/// Field of a snapshot: the voltage(unit: mV, data ID 1).
+#define SNAPSHOT_VOLTAGE		2
+/// Field of a snapshot: the current(unit: mA, data ID 2).
+#define SNAPSHOT_CURRENT		3
+/// Field of a snapshot: the power(unit: mW, data ID 3).
+#define SNAPSHOT_POWER			4
+/// Field of a snapshot: the temperature(data ID 4).
+#define SNAPSHOT_TEMPERATURE	5
+/// Number of fields.
+#define SNAPSHOT_FIELDS			6
+
+/*!
+ * State of one servo in a snapshot.
+ */
+struct ServoState
+{
+	/// Servo ID.
+	byte id;
+	/// Fields received during the sweep of the snapshot, bits (1 << SNAPSHOT_ANGLE), ...
+	/// The other fields keep the values of an earlier sweep.
+	byte fresh;
+	/// Values indexed by SNAPSHOT_ANGLE, ...
+	long values[SNAPSHOT_FIELDS];
+	/// Receive time of each value(unit: micro second), zero if it has never been received.
+	unsigned long times[SNAPSHOT_FIELDS];
+};
+
+/*!
+ * State of all swept servos, published at the end of a sweep.
+ */
+struct StateSnapshot
+{
+	/// Number of the sweep, from 1.
+	unsigned long sweep;
+	/// Time the sweep started(unit: micro second).
+	unsigned long start;
+	/// Time the sweep ended(unit: micro second).
+	unsigned long end;
+	/// Number of servos.
+	byte count;
+	ServoState servos[SNAPSHOT_SERVOS];
+};
+
+/*!
+ * ServoSnapshot class
+ * Sweeps a set of servos once per period and publishes their angles, status and selected telemetry
+ * as one snapshot, every value stamped with its receive time.
+ * A sweep reads the angles of all servos first, then each other field in turn, so the angles are as close in time as the bus allows.
+ * A sweep not finished at the start of the next one is published without the missing fields.
+ *
+ * Snapshots are double-buffered: a sweep fills the back buffer while read() copies the front one,
+ * and a sequence number tells a reader that a copy overlapped a publish (seqlock), so it copies again.
+ * Readers never wait on the bus and never block the sweep, also from other threads (see ServoThread).
+ *
+ * Attach it to a UARTServo object, the sweeps run from UARTServo::update().
+ */
+class ServoSnapshot : public UARTServoTask, public ResponseHandler
+{
+public:
+	ServoSnapshot();
+
+	/*!
+	 * Add a servo to the sweeps, from the next sweep on.
+	 *
+	 * \param id Servo ID.
+	 * \return Index of the servo in the snapshots, -1 if there is no room.
+	 */
+	int add(byte id);
+
+	/*!
+	 * Remove all servos, from the next sweep on.
+	 */
+	void clear();
+
+	/*!
+	 * Select the swept fields, default value is (1 << SNAPSHOT_STATUS). The angle is always swept.
+	 *
+	 * \param fields Bits (1 << SNAPSHOT_STATUS), (1 << SNAPSHOT_VOLTAGE), ...
+	 */
+	void setFields(byte fields);
+
+	/*!
+	 * Set the sweep period, default value is SNAPSHOT_PERIOD.
+	 *
+	 * \param period Sweep period(unit: millisecond).
+	 */
+	void setPeriod(unsigned long period);
+
+	/*!
+	 * Limit the number of reads waiting for their responses, default value is 4.
+	 */
+	void setMaxInFlight(byte count);
+
+	/*!
+	 * Copy the latest snapshot.
+	 *
+	 * \return false if no sweep has ended yet.
+	 */
+	bool read(StateSnapshot* snapshot) const;
+
+	/// Number of the latest snapshot, zero if no sweep has ended yet.
+	unsigned long getSweep() const;
+
+	/// Number of sweeps published with fields missing because the period ended first.
+	unsigned long getOverruns() const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+	void onResponse(byte id, byte number, const byte* payload, byte length);
+	void onTimeout(byte id, byte number, byte argument);
+
+private:
+	byte _ids[SNAPSHOT_SERVOS];
+	byte _count;
+	byte _fields;
+	unsigned long _period;
+	byte _maxInFlight;
+	unsigned long _overruns;
+
+	StateSnapshot _buffers[2];
+	/// Number of the latest snapshot, it is in _buffers[_sequence & 1] and the next one is filled in the other buffer.
+#ifdef ARDUINO
+	unsigned long _sequence;
+#else
+	std::atomic<unsigned long> _sequence;
+#endif
+
+	/// Whether the first poll has set the start of the cadence.
+	bool _started;
+	bool _sweeping;
+	unsigned long _due;
+	/// Next read of the sweep: field, then servo index.
+	byte _field;
+	byte _next;
+	byte _inFlight;
+	/// Whether the last send found the pending-request table full.
+	bool _blocked;
+	/// Fields of each servo waiting for their responses.
+	byte _pending[SNAPSHOT_SERVOS];
+
+	/// Field of a response, -1 if it is not one of the sweep.
+	static int findField(byte number, byte dataID);
+	StateSnapshot& getBack();
+	void begin(unsigned long now);
+	void send(UARTServo& servo);
+	void cancel(UARTServo& servo);
+	void publish();
+	void complete(byte id, byte field, bool received, long value);
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "ServoTelemetry.h"
+
+ServoTelemetry::ServoTelemetry()
+	: _count(0), _next(0), _inFlight(0), _maxInFlight(4), _blocked(false), _servo(NULL)
+{
+}
+
+int ServoTelemetry::add(byte id, byte dataID, unsigned long period)
+{
+	if (_count >= TELEMETRY_ENTRIES)
+	{
+		return -1;
+	}
+	byte index = _count++;
+	_ids[index] = id;
+	_dataIDs[index] = dataID;
+	_flags[index] = 0;
+	_missed[index] = 0;
+	_periods[index] = period;
+	_due[index] = millis();
+	_values[index] = 0;
+	_timestamps[index] = 0;
+	return index;
+}
+
+void ServoTelemetry::clear()
+{
+	// Stop waiting for the polls in flight, so their late responses are not matched against new entries.
+	for (byte i = 0; i < _count; i++)
+	{
+		if ((_flags[i] & FLAG_IN_FLIGHT) != 0)
+		{
+			_servo->cancelRequest(_ids[i], (_dataIDs[i] == TELEMETRY_ANGLE) ? PACKET_READ_ANGLE : PACKET_READ_DATA, this);
+		}
+	}
+	_count = 0;
+	_next = 0;
+	_inFlight = 0;
+}
+
+int ServoTelemetry::find(byte id, byte dataID) const
+{
+	for (byte i = 0; i < _count; i++)
+	{
+		if (_ids[i] == id && _dataIDs[i] == dataID)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ServoTelemetry::setMaxInFlight(byte count)
+{
+	_maxInFlight = count;
+}
+
+byte ServoTelemetry::getCount() const
+{
+	return _count;
+}
+
+bool ServoTelemetry::isValid(byte index) const
+{
+	return (_flags[index] & FLAG_VALID) != 0;
+}
+
+long ServoTelemetry::getValue(byte index) const
+{
+	return _values[index];
+}
+
+unsigned long ServoTelemetry::getTimestamp(byte index) const
+{
+	return _timestamps[index];
+}
+
+byte ServoTelemetry::getMissed(byte index) const
+{
+	return _missed[index];
+}
+
+void ServoTelemetry::poll(UARTServo& servo, unsigned long now)
+{
+	// Round-robin from where the last poll stopped, so every entry gets its share of the bus.
+	_servo = &servo;
+	_blocked = false;
+	for (byte n = 0; n < _count && _inFlight < _maxInFlight; n++)
+	{
+		byte i = _next;
+		_next = (_next + 1 < _count) ? _next + 1 : 0;
+
+		if ((_flags[i] & FLAG_IN_FLIGHT) != 0 || (long)(now - _due[i]) < 0)
+		{
+			continue;
+		}
+
+		byte payload[2] = { _ids[i], _dataIDs[i] };
+		bool sent = (_dataIDs[i] == TELEMETRY_ANGLE)
+			? servo.sendRequest(PACKET_READ_ANGLE, payload, 1, this)
+			: servo.sendRequest(PACKET_READ_DATA, payload, 2, this);
+		if (!sent)
+		{
+			// The pending-request table is full, try again after a response or a request deadline.
+			_blocked = true;
+			break;
+		}
+		_flags[i] |= FLAG_IN_FLIGHT;
+		_inFlight++;
+		// Keep the rate even if a poll is late.
+		_due[i] += _periods[i];
+		if ((long)(now - _due[i]) >= 0)
+		{
+			_due[i] = now + _periods[i];
+		}
+	}
+}
+
+unsigned long ServoTelemetry::getPollDelay(unsigned long now) const
+{
+	if (_inFlight >= _maxInFlight || _blocked)
+	{
+		// A response, or the deadline of a pending request, frees a slot first.
+		return POLL_IDLE;
+	}
+	unsigned long delay = POLL_IDLE;
+	for (byte i = 0; i < _count; i++)
+	{
+		if ((_flags[i] & FLAG_IN_FLIGHT) == 0)
+		{
+			long left = (long)(_due[i] - now);
+			if (left <= 0)
+			{
+				return 0;
+			}
+			if ((unsigned long)left < delay)
+			{
+				delay = left;
+			}
+		}
+	}
+	return delay;
+}
+
+void ServoTelemetry::onResponse(byte id, byte number, const byte* payload, byte length)
+{
+	// The pending-request table matched the data ID of the response with its request,
+	// so the entry is found by the same key as in onTimeout().
+	int index = findInFlight(id, number, (length >= 2) ? payload[1] : 0);
+	if (index < 0)
+	{
+		return;
+	}
+	_flags[index] &= ~FLAG_IN_FLIGHT;
+	_inFlight--;
+
+	FrameReader reader(payload + 1, length - 1);
+	if (number == PACKET_READ_DATA)
+	{
+		reader.read();
+	}
+	// Data IDs of the data table are decoded by their size and signedness, others by the reply length.
+	byte dataID = _dataIDs[index];
+	byte dataSize = (number == PACKET_READ_DATA) ? getDataSize(dataID) : 0;
+	if (dataSize > 0 && reader.getRemaining() != dataSize)
+	{
+		// A malformed value counts as a missed poll.
+		miss(index);
+		return;
+	}
+	long value;
+	if (number == PACKET_READ_ANGLE || (dataSize == 2 && isUserDataSigned(dataID)))
+	{
+		value = reader.readInt();
+	}
+	else if (reader.getRemaining() >= 4)
+	{
+		value = (long)reader.readULong();
+	}
+	else if (reader.getRemaining() >= 2)
+	{
+		value = reader.readUInt();
+	}
+	else
+	{
+		value = reader.read();
+	}
+
+	_values[index] = value;
+	_timestamps[index] = millis();
+	_flags[index] |= FLAG_VALID;
+}
+
+void ServoTelemetry::onTimeout(byte id, byte number, byte argument)
+{
+	int index = findInFlight(id, number, argument);
+	if (index < 0)
+	{
+		return;
+	}
+	_flags[index] &= ~FLAG_IN_FLIGHT;
+	_inFlight--;
+	miss(index);
+}
+
+void ServoTelemetry::miss(byte index)
+{
+	if (_missed[index] < 0xff)
+	{
+		_missed[index]++;
+	}
+}
+
+int ServoTelemetry::findInFlight(byte id, byte number, byte argument) const
+{
+	byte dataID = (number == PACKET_READ_DATA) ? argument : TELEMETRY_ANGLE;
+	for (byte i = 0; i < _count; i++)
+	{
+		if (_ids[i] == id && _dataIDs[i] == dataID && (_flags[i] & FLAG_IN_FLIGHT) != 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,107 @@
+// ServoTelemetry.h
+
+#ifndef SERVOTELEMETRY_H
+#define SERVOTELEMETRY_H
+
+#include "UARTServo.h"
+
+/// Maximum number of polled fields.
+#ifndef TELEMETRY_ENTRIES
+#define TELEMETRY_ENTRIES		32
+#endif
+
+/// Pseudo data ID of the current angle, polled by the read angle command.
+#define TELEMETRY_ANGLE			0
+
+/*!
+ * ServoTelemetry class
+ * Polls configured (servo, data ID) fields in the background at their own rates,
+ * and keeps the latest value of each one with its receive time.
+ * Attach it to a UARTServo object, the polls are sent round-robin from UARTServo::update().
+ *
+ * The cache is a structure of arrays indexed by the entry returned from add(),
+ * so reading it never waits for the bus.
+ */
+class ServoTelemetry : public UARTServoTask, public ResponseHandler
+{
+public:
+	ServoTelemetry();
+
+	/*!
+	 * Poll a field.
+	 *
+	 * \param id Servo ID.
+	 * \param dataID Data ID (see uart-servo-data-table.md), or TELEMETRY_ANGLE.
+	 * \param period Poll period(unit: millisecond).
+	 * \return Entry index, -1 if there is no room.
+	 */
+	int add(byte id, byte dataID, unsigned long period);
+
+	/*!
+	 * Remove all fields, the polls waiting for their responses are cancelled.
+	 */
+	void clear();
+
+	/*!
+	 * Find the entry of a field.
+	 *
+	 * \return Entry index, -1 if it is not polled.
+	 */
+	int find(byte id, byte dataID) const;
+
+	/*!
+	 * Limit the number of polls waiting for their responses, default value is 4.
+	 */
+	void setMaxInFlight(byte count);
+
+	/// Number of entries.
+	byte getCount() const;
+
+	/// Whether a value has been received for the entry.
+	bool isValid(byte index) const;
+
+	/// Latest value of the entry, unsigned fields are zero-extended, angles are signed(unit: 0.1 degree).
+	long getValue(byte index) const;
+
+	/// Time the latest value has been received(unit: millisecond).
+	unsigned long getTimestamp(byte index) const;
+
+	/// Number of polls of the entry that got no response.
+	byte getMissed(byte index) const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+	void onResponse(byte id, byte number, const byte* payload, byte length);
+	void onTimeout(byte id, byte number, byte argument);
+
+private:
+	enum Flag
+	{
+		FLAG_VALID = 0x01,
+		FLAG_IN_FLIGHT = 0x02
+	};
+
+	byte _ids[TELEMETRY_ENTRIES];
+	byte _dataIDs[TELEMETRY_ENTRIES];
+	byte _flags[TELEMETRY_ENTRIES];
+	byte _missed[TELEMETRY_ENTRIES];
+	unsigned long _periods[TELEMETRY_ENTRIES];
+	unsigned long _due[TELEMETRY_ENTRIES];
+	long _values[TELEMETRY_ENTRIES];
+	unsigned long _timestamps[TELEMETRY_ENTRIES];
+
+	byte _count;
+	byte _next;
+	byte _inFlight;
+	byte _maxInFlight;
+	/// Whether the last poll found the pending-request table full.
+	bool _blocked;
+	/// The object the polls are sent through, set by poll().
+	UARTServo* _servo;
+
+	/// Entry of a poll waiting for its response, by the key of the pending-request table.
+	int findInFlight(byte id, byte number, byte argument) const;
+	void miss(byte index);
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "ServoThread.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+ServoThread::ServoThread(UARTServo& servo)
+	: _servo(servo), _running(false), _sleeping(false), _dropped(0), _holding(false)
+{
+	if (pipe2(_wakeup, O_NONBLOCK | O_CLOEXEC) != 0)
+	{
+		_wakeup[0] = -1;
+		_wakeup[1] = -1;
+	}
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		_slots[i].owner = this;
+		_slots[i].busy = false;
+		_slots[i].tag = 0;
+	}
+}
+
+ServoThread::~ServoThread()
+{
+	stop();
+	if (_wakeup[0] >= 0)
+	{
+		close(_wakeup[0]);
+		close(_wakeup[1]);
+	}
+}
+
+bool ServoThread::start()
+{
+	if (_running.load() || _wakeup[0] < 0)
+	{
+		return false;
+	}
+	_running.store(true);
+	_thread = std::thread(&ServoThread::run, this);
+	return true;
+}
+
+void ServoThread::stop()
+{
+	if (!_running.exchange(false))
+	{
+		return;
+	}
+	wake();
+	_thread.join();
+
+	// The UARTServo object goes back to the caller, it must not call the slots once this object is gone.
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		Slot* slot = &_slots[i];
+		if (slot->busy)
+		{
+			_servo.cancelRequest(slot->id, slot->number, slot);
+			slot->busy = false;
+			publish(THREAD_CANCELLED, slot->id, slot->number, slot->tag);
+		}
+	}
+	if (_holding)
+	{
+		_holding = false;
+		publish(THREAD_NOT_SENT, _held.payload[0], _held.number, _held.tag);
+	}
+}
+
+bool ServoThread::isRunning() const
+{
+	return _running.load();
+}
+
+bool ServoThread::submit(byte number, const byte* payload, byte size, unsigned long tag, bool reply)
+{
+	if (size == 0 || size > THREAD_PAYLOAD)
+	{
+		return false;
+	}
+	Command command;
+	command.number = number;
+	command.size = size;
+	command.reply = reply;
+	command.tag = tag;
+	memcpy(command.payload, payload, size);
+	if (!_commands.push(command))
+	{
+		return false;
+	}
+	// Pairs with the fence in wait(): either the bus thread sees the command, or this thread sees it sleeping.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// Only the first command queued while it sleeps pays for the system call.
+	if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false, std::memory_order_relaxed))
+	{
+		wake();
+	}
+	return true;
+}
+
+bool ServoThread::ping(byte id, unsigned long tag)
+{
+	return submit(PACKET_PING, &id, 1, tag);
+}
+
+bool ServoThread::readAngle(byte id, unsigned long tag)
+{
+	return submit(PACKET_READ_ANGLE, &id, 1, tag);
+}
+
+bool ServoThread::rotate(byte id, int angle, unsigned int interval, unsigned int power, unsigned long tag, bool reply)
+{
+	RotateFrame frame;
+	encodeRotate(frame, id, angle, interval, power);
+	return submit(PACKET_ROTATE, frame.getPayload(), frame.SIZE, tag, reply);
+}
+
+bool ServoThread::rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power, unsigned long tag, bool reply)
+{
+	RotateByIntervalFrame frame;
+	encodeRotateBy(frame, id, angle, interval, accInterval, decInterval, power);
+	return submit(PACKET_ROTATE_BY_INTERVAL, frame.getPayload(), frame.SIZE, tag, reply);
+}
+
+bool ServoThread::damping(byte id, unsigned int power, unsigned long tag, bool reply)
+{
+	DampingFrame frame;
+	encodeDamping(frame, id, power);
+	return submit(PACKET_DAMPING, frame.getPayload(), frame.SIZE, tag, reply);
+}
+
+bool ServoThread::receive(ThreadResponse* response)
+{
+	return _responses.pop(response);
+}
+
+unsigned long ServoThread::getDropped() const
+{
+	return _dropped.load(std::memory_order_relaxed);
+}
+
+void ServoThread::run()
+{
+	while (_running.load())
+	{
+		sendCommands();
+		_servo.onReadable();
+		_servo.onWritable();
+		_servo.onDeadline();
+		// Responses and timeouts may have freed slots for a held command.
+		sendCommands();
+		wait();
+	}
+}
+
+void ServoThread::sendCommands()
+{
+	for (;;)
+	{
+		if (!_holding)
+		{
+			if (!_commands.pop(&_held))
+			{
+				return;
+			}
+			_holding = true;
+		}
+		Slot* slot = NULL;
+		if (_held.reply && _held.payload[0] != ALL_SERVOS)
+		{
+			for (byte i = 0; i < PENDING_REQUESTS && slot == NULL; i++)
+			{
+				if (!_slots[i].busy)
+				{
+					slot = &_slots[i];
+				}
+			}
+			if (slot == NULL)
+			{
+				return;
+			}
+		}
+		if (!_servo.sendRequest(_held.number, _held.payload, _held.size, slot))
+		{
+			// The pending-request table is full, it is shared with the tasks of the UARTServo object.
+			return;
+		}
+		if (slot != NULL)
+		{
+			slot->busy = true;
+			slot->tag = _held.tag;
+			slot->id = _held.payload[0];
+			slot->number = _held.number;
+		}
+		_holding = false;
+	}
+}
+
+void ServoThread::wait()
+{
+	_sleeping.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!_holding && _commands.isReady())
+	{
+		_sleeping.store(false, std::memory_order_relaxed);
+		return;
+	}
+	struct pollfd fds[2];
+	nfds_t count = 1;
+	fds[0].fd = _wakeup[0];
+	fds[0].events = POLLIN;
+	long timeout = _servo.getPollTimeout();
+	int fd = _servo.getFileDescriptor();
+	if (fd >= 0)
+	{
+		fds[1].fd = fd;
+		fds[1].events = POLLIN | (_servo.isWritePending() ? POLLOUT : 0);
+		count = 2;
+	}
+	else if (timeout < 0 || timeout > 1)
+	{
+		// A transport without a descriptor can only be polled.
+		timeout = 1;
+	}
+	poll(fds, count, (int)timeout);
+	_sleeping.store(false, std::memory_order_relaxed);
+	if (fds[0].revents & POLLIN)
+	{
+		byte buffer[64];
+		while (read(_wakeup[0], buffer, sizeof(buffer)) > 0)
+		{
+		}
+	}
+}
+
+void ServoThread::wake()
+{
+	// A full pipe already wakes the bus thread, the byte can be lost.
+	byte data = 0;
+	ssize_t written = write(_wakeup[1], &data, 1);
+	(void)written;
+}
+
+void ServoThread::publish(const ThreadResponse& response)
+{
+	if (!_responses.push(response))
+	{
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void ServoThread::publish(byte kind, byte id, byte number, unsigned long tag)
+{
+	ThreadResponse response;
+	response.kind = kind;
+	response.id = id;
+	response.number = number;
+	response.length = 0;
+	response.tag = tag;
+	publish(response);
+}
+
+void ServoThread::Slot::onResponse(byte id, byte number, const byte* payload, byte length)
+{
+	ThreadResponse response;
+	response.kind = THREAD_RESPONSE;
+	response.id = id;
+	response.number = number;
+	response.length = (length < THREAD_PAYLOAD) ? length : THREAD_PAYLOAD;
+	response.tag = tag;
+	memcpy(response.payload, payload, response.length);
+	busy = false;
+	owner->publish(response);
+}
+
+void ServoThread::Slot::onTimeout(byte id, byte number, byte)
+{
+	busy = false;
+	owner->publish(THREAD_TIMEOUT, id, number, tag);
+}
+
+#endif
@@ -0,0 +1,266 @@
+// ServoThread.h
+
+#ifndef SERVOTHREAD_H
+#define SERVOTHREAD_H
+
+#include "UARTServo.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <atomic>
+#include <thread>
+
+/// Number of commands the submit ring holds, a power of two.
+#ifndef THREAD_COMMANDS
+#define THREAD_COMMANDS			256
+#endif
+
+/// Number of responses the response ring holds, a power of two.
+#ifndef THREAD_RESPONSES
+#define THREAD_RESPONSES		256
+#endif
+
+/// Largest command or response payload, the write batch data request.
+#define THREAD_PAYLOAD			(1 + USER_DATA_SIZE)
+
+/// Kind of a ThreadResponse: the response of a command arrived.
+#define THREAD_RESPONSE			0
+/// Kind of a ThreadResponse: the command got no response after all retries.
+#define THREAD_TIMEOUT			1
+/// Kind of a ThreadResponse: the bus thread stopped while the command waited for its response.
+#define THREAD_CANCELLED		2
+/// Kind of a ThreadResponse: the bus thread stopped before the command could be sent.
+#define THREAD_NOT_SENT			3
+
+/*!
+ * ServoRing class
+ * Bounded lock-free ring of N items, N must be a power of two.
+ * Any number of threads may push, one thread pops. Each cell carries a sequence number
+ * telling whether it is free for the push of a round or filled for its pop, so neither side takes a lock
+ * and a push is one compare-and-swap plus the copy of the item.
+ */
+template<typename T, unsigned int N>
+class ServoRing
+{
+public:
+	ServoRing() : _head(0), _tail(0)
+	{
+		for (unsigned int i = 0; i < N; i++)
+		{
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	/*!
+	 * Add an item, from any thread.
+	 *
+	 * \return false if the ring is full.
+	 */
+	bool push(const T& item)
+	{
+		unsigned int tail = _tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell* cell = &_cells[tail & MASK];
+			int diff = (int)(cell->sequence.load(std::memory_order_acquire) - tail);
+			if (diff == 0)
+			{
+				if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					cell->item = item;
+					cell->sequence.store(tail + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				tail = _tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/*!
+	 * Take the oldest item, from the consumer thread only.
+	 *
+	 * \return false if the ring is empty.
+	 */
+	bool pop(T* item)
+	{
+		Cell* cell = &_cells[_head & MASK];
+		if ((int)(cell->sequence.load(std::memory_order_acquire) - (_head + 1)) < 0)
+		{
+			return false;
+		}
+		*item = cell->item;
+		cell->sequence.store(_head + N, std::memory_order_release);
+		_head++;
+		return true;
+	}
+
+	/// Whether an item is ready to pop, from the consumer thread only.
+	bool isReady() const
+	{
+		return _cells[_head & MASK].sequence.load(std::memory_order_acquire) == _head + 1;
+	}
+
+private:
+	static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+	static const unsigned int MASK = N - 1;
+
+	struct Cell
+	{
+		std::atomic<unsigned int> sequence;
+		T item;
+	};
+
+	Cell _cells[N];
+	// The two ends on their own cache lines, so producers and the consumer do not share one.
+	alignas(64) unsigned int _head;
+	alignas(64) std::atomic<unsigned int> _tail;
+};
+
+/*!
+ * A response or timeout handed back by ServoThread::receive().
+ */
+struct ThreadResponse
+{
+	/// THREAD_RESPONSE, THREAD_TIMEOUT, THREAD_CANCELLED or THREAD_NOT_SENT.
+	byte kind;
+	/// Servo ID.
+	byte id;
+	/// Packet number.
+	byte number;
+	/// Payload length, zero for a timeout.
+	byte length;
+	/// Tag given to the command.
+	unsigned long tag;
+	/// Response payload, starting with the servo ID.
+	byte payload[THREAD_PAYLOAD];
+};
+
+/*!
+ * ServoThread class
+ * Runs a UARTServo object on a bus thread of its own, so the control thread never blocks on the serial port.
+ * Commands are encoded by the calling thread and pushed into a lock-free ring, the bus thread sends them,
+ * runs the parser, and pushes the responses into a second ring that the application drains with receive().
+ * A command returns once it is queued, it never makes a system call unless the bus thread sleeps.
+ *
+ * Between start() and stop() the UARTServo object, its transport and its tasks belong to the bus thread:
+ * the other threads only use this object.
+ */
+class ServoThread
+{
+public:
+	/*!
+	 * \param servo The UARTServo object, begun with its transport.
+	 */
+	ServoThread(UARTServo& servo);
+	~ServoThread();
+
+	/*!
+	 * Start the bus thread.
+	 *
+	 * \return false if it is already running or cannot be started.
+	 */
+	bool start();
+
+	/*!
+	 * Stop the bus thread and wait for it, the commands still queued are not sent.
+	 * Commands waiting for their responses are cancelled in the UARTServo object and reported as THREAD_CANCELLED,
+	 * the one held back for a free slot is dropped and reported as THREAD_NOT_SENT.
+	 */
+	void stop();
+
+	bool isRunning() const;
+
+	/*!
+	 * Queue a request, from any thread.
+	 *
+	 * \param number Packet number.
+	 * \param payload Request payload, starting with the servo ID.
+	 * \param size Payload size, at most THREAD_PAYLOAD.
+	 * \param tag Value returned with the response, to match it to this command.
+	 * \param reply Whether a response is expected. Requests to ALL_SERVOS never get one.
+	 * \return false if the ring is full or the request is too large.
+	 */
+	bool submit(byte number, const byte* payload, byte size, unsigned long tag = 0, bool reply = true);
+
+	/// Detect status of a servo, see UARTServo::ping().
+	bool ping(byte id, unsigned long tag = 0);
+
+	/// Read the angle of a servo, see UARTServo::readAngle().
+	bool readAngle(byte id, unsigned long tag = 0);
+
+	/// Rotate a servo, see UARTServo::rotate().
+	bool rotate(byte id, int angle, unsigned int interval, unsigned int power = 0, unsigned long tag = 0, bool reply = false);
+
+	/// Rotate a servo by intervals, see UARTServo::rotateByInterval().
+	bool rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0, unsigned long tag = 0, bool reply = false);
+
+	/// Damp a servo, see UARTServo::damping().
+	bool damping(byte id, unsigned int power = 0, unsigned long tag = 0, bool reply = false);
+
+	/*!
+	 * Take the oldest response, from one thread only.
+	 *
+	 * \return false if there is none.
+	 */
+	bool receive(ThreadResponse* response);
+
+	/// Number of responses lost because the response ring was full.
+	unsigned long getDropped() const;
+
+private:
+	struct Command
+	{
+		byte number;
+		byte size;
+		bool reply;
+		unsigned long tag;
+		byte payload[THREAD_PAYLOAD];
+	};
+
+	/// Pending command on the bus thread, its response is routed back with the tag.
+	class Slot : public ResponseHandler
+	{
+	public:
+		ServoThread* owner;
+		bool busy;
+		unsigned long tag;
+		/// Key of the request in the pending-request table.
+		byte id;
+		byte number;
+
+		void onResponse(byte id, byte number, const byte* payload, byte length);
+		void onTimeout(byte id, byte number, byte argument);
+	};
+
+	UARTServo& _servo;
+	ServoRing<Command, THREAD_COMMANDS> _commands;
+	ServoRing<ThreadResponse, THREAD_RESPONSES> _responses;
+	Slot _slots[PENDING_REQUESTS];
+	std::thread _thread;
+	std::atomic<bool> _running;
+	std::atomic<bool> _sleeping;
+	std::atomic<unsigned long> _dropped;
+	/// Pipe waking the bus thread from poll() when a command is queued.
+	int _wakeup[2];
+	/// Command taken from the ring but not sent yet, for lack of a free slot.
+	Command _held;
+	bool _holding;
+
+	void run();
+	void sendCommands();
+	void wait();
+	void wake();
+	void publish(const ThreadResponse& response);
+	void publish(byte kind, byte id, byte number, unsigned long tag);
+};
+
+#endif
+
+#endif
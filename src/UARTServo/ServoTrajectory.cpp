@@ -0,0 +1,184 @@
+#include "ServoTrajectory.h"
+
+ServoTrajectory::ServoTrajectory()
+	: _count(0), _period(TRAJECTORY_PERIOD), _started(false), _due(0), _number(PACKET_ROTATE), _accInterval(0), _decInterval(0)
+{
+}
+
+int ServoTrajectory::add(byte id, int angle)
+{
+	if (_count >= TRAJECTORY_SERVOS)
+	{
+		return -1;
+	}
+	byte index = _count++;
+	_ids[index] = id;
+	_angles[index] = angle;
+	_heads[index] = 0;
+	_queued[index] = 0;
+	_dropped[index] = 0;
+	_merged[index] = 0;
+	return index;
+}
+
+void ServoTrajectory::clear()
+{
+	_count = 0;
+}
+
+int ServoTrajectory::find(byte id) const
+{
+	for (byte i = 0; i < _count; i++)
+	{
+		if (_ids[i] == id)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ServoTrajectory::setPeriod(unsigned long period)
+{
+	_period = period;
+}
+
+void ServoTrajectory::setPacket(byte number, unsigned int accInterval, unsigned int decInterval)
+{
+	_number = number;
+	_accInterval = accInterval;
+	_decInterval = decInterval;
+}
+
+void ServoTrajectory::push(byte index, unsigned long time, int angle)
+{
+	byte queued = _queued[index];
+	if (queued > 0)
+	{
+		byte last = (_heads[index] + queued - 1) % TRAJECTORY_POINTS;
+		if ((long)(time - _times[index][last]) <= 0)
+		{
+			_times[index][last] = time;
+			_targets[index][last] = angle;
+			_merged[index]++;
+			return;
+		}
+	}
+	if (queued == TRAJECTORY_POINTS)
+	{
+		_heads[index] = (_heads[index] + 1) % TRAJECTORY_POINTS;
+		_dropped[index]++;
+		queued--;
+	}
+	byte tail = (_heads[index] + queued) % TRAJECTORY_POINTS;
+	_times[index][tail] = time;
+	_targets[index][tail] = angle;
+	_queued[index] = queued + 1;
+}
+
+byte ServoTrajectory::getCount() const
+{
+	return _count;
+}
+
+byte ServoTrajectory::getQueued(byte index) const
+{
+	return _queued[index];
+}
+
+unsigned long ServoTrajectory::getDropped(byte index) const
+{
+	return _dropped[index];
+}
+
+unsigned long ServoTrajectory::getMerged(byte index) const
+{
+	return _merged[index];
+}
+
+void ServoTrajectory::poll(UARTServo& servo, unsigned long now)
+{
+	if (!_started)
+	{
+		// The cadence starts from the first poll, a fixed origin may be more than half the clock range away.
+		_started = true;
+		_due = now;
+	}
+	if ((long)(now - _due) < 0)
+	{
+		return;
+	}
+	_due += _period;
+	if ((long)(now - _due) >= 0)
+	{
+		// Cycles have been missed, restart the cadence from now.
+		_due = now + _period;
+	}
+
+	ServoMotion motions[TRAJECTORY_SERVOS];
+	byte count = 0;
+	for (byte i = 0; i < _count; i++)
+	{
+		// Take the setpoints due before the next cycle, the last one is the target.
+		byte taken = 0;
+		unsigned long time = 0;
+		int angle = 0;
+		while (_queued[i] > 0 && (long)(_times[i][_heads[i]] - _due) <= 0)
+		{
+			time = _times[i][_heads[i]];
+			angle = _targets[i][_heads[i]];
+			_heads[i] = (_heads[i] + 1) % TRAJECTORY_POINTS;
+			_queued[i]--;
+			taken++;
+		}
+		if (taken == 0)
+		{
+			continue;
+		}
+		_merged[i] += taken - 1;
+
+		// A late setpoint is reached within one period.
+		long interval = (long)(time - now);
+		if (interval <= 0)
+		{
+			interval = _period;
+		}
+		ServoMotion& motion = motions[count++];
+		motion.id = _ids[i];
+		motion.angle = angle;
+		motion.interval = (unsigned int)interval;
+		motion.accInterval = _accInterval;
+		motion.decInterval = _decInterval;
+		motion.power = 0;
+		if (_number == PACKET_ROTATE_BY_VELOCITY)
+		{
+			// Velocity(unit: degree per second) covering the distance(unit: 0.1 degree) in the interval.
+			long distance = (long)angle - _angles[i];
+			if (distance < 0)
+			{
+				distance = -distance;
+			}
+			unsigned long velocity = (unsigned long)distance * 100 / (unsigned long)interval;
+			motion.interval = (unsigned int)((velocity > 0) ? velocity : 1);
+		}
+		_angles[i] = angle;
+	}
+	if (count > 0)
+	{
+		servo.rotateGroup(motions, count, _number);
+	}
+}
+
+unsigned long ServoTrajectory::getPollDelay(unsigned long now) const
+{
+	if (_count == 0)
+	{
+		return POLL_IDLE;
+	}
+	if (!_started)
+	{
+		return 0;
+	}
+	long left = (long)(_due - now);
+	return (left > 0) ? left : 0;
+}
@@ -0,0 +1,121 @@
+// ServoTrajectory.h
+
+#ifndef SERVOTRAJECTORY_H
+#define SERVOTRAJECTORY_H
+
+#include "UARTServo.h"
+
+/// Maximum number of streamed servos.
+#ifndef TRAJECTORY_SERVOS
+#define TRAJECTORY_SERVOS		8
+#endif
+
+/// Look-ahead buffer size of each servo(unit: setpoint).
+#ifndef TRAJECTORY_POINTS
+#define TRAJECTORY_POINTS		8
+#endif
+
+/// Default cadence of the motion frames(unit: millisecond).
+#define TRAJECTORY_PERIOD		10
+
+/*!
+ * ServoTrajectory class
+ * Streams timestamped setpoints to servos on a fixed cadence.
+ * A setpoint (time, angle) asks the servo to reach the angle at the time, on the millis() clock.
+ * Setpoints wait in a look-ahead buffer per servo. Every period, the last setpoint due before the next cycle
+ * becomes the target of each servo, and its interval is the time left until the setpoint.
+ * Setpoints skipped over are merged into it, and late ones are reached within one period,
+ * so the bus never falls further behind the planner than one cycle.
+ * The frames of a cycle are sent together by UARTServo::rotateGroup().
+ *
+ * Attach it to a UARTServo object, the frames are sent from UARTServo::update().
+ */
+class ServoTrajectory : public UARTServoTask
+{
+public:
+	ServoTrajectory();
+
+	/*!
+	 * Stream setpoints to a servo.
+	 *
+	 * \param id Servo ID.
+	 * \param angle Current angle(unit: 0.1 degree), the start of the first motion in PACKET_ROTATE_BY_VELOCITY mode.
+	 * \return Servo index, -1 if there is no room.
+	 */
+	int add(byte id, int angle = 0);
+
+	/*!
+	 * Remove all servos.
+	 */
+	void clear();
+
+	/*!
+	 * Find the index of a servo.
+	 *
+	 * \return Servo index, -1 if it is not streamed.
+	 */
+	int find(byte id) const;
+
+	/*!
+	 * Set the cadence of the motion frames, default value is TRAJECTORY_PERIOD.
+	 *
+	 * \param period Cycle time(unit: millisecond).
+	 */
+	void setPeriod(unsigned long period);
+
+	/*!
+	 * Set the motion command, default value is PACKET_ROTATE.
+	 *
+	 * \param number PACKET_ROTATE, PACKET_ROTATE_BY_INTERVAL or PACKET_ROTATE_BY_VELOCITY.
+	 * The velocity of PACKET_ROTATE_BY_VELOCITY is derived from the distance and time to the setpoint.
+	 * \param accInterval Acceleration interval, not used by PACKET_ROTATE.
+	 * \param decInterval Deceleration interval, not used by PACKET_ROTATE.
+	 */
+	void setPacket(byte number, unsigned int accInterval = 0, unsigned int decInterval = 0);
+
+	/*!
+	 * Queue a setpoint.
+	 * A setpoint not later than the last queued one replaces it. If the buffer is full, the oldest setpoint is dropped.
+	 *
+	 * \param index Servo index.
+	 * \param time Time to reach the angle(unit: millisecond, on the millis() clock).
+	 * \param angle Angle(unit: 0.1 degree).
+	 */
+	void push(byte index, unsigned long time, int angle);
+
+	/// Number of servos.
+	byte getCount() const;
+
+	/// Number of setpoints waiting in the buffer of a servo.
+	byte getQueued(byte index) const;
+
+	/// Number of setpoints of a servo dropped because its buffer was full.
+	unsigned long getDropped(byte index) const;
+
+	/// Number of setpoints of a servo merged into a later one.
+	unsigned long getMerged(byte index) const;
+
+	void poll(UARTServo& servo, unsigned long now);
+	unsigned long getPollDelay(unsigned long now) const;
+
+private:
+	byte _ids[TRAJECTORY_SERVOS];
+	int _angles[TRAJECTORY_SERVOS];
+	byte _heads[TRAJECTORY_SERVOS];
+	byte _queued[TRAJECTORY_SERVOS];
+	unsigned long _dropped[TRAJECTORY_SERVOS];
+	unsigned long _merged[TRAJECTORY_SERVOS];
+	unsigned long _times[TRAJECTORY_SERVOS][TRAJECTORY_POINTS];
+	int _targets[TRAJECTORY_SERVOS][TRAJECTORY_POINTS];
+
+	byte _count;
+	unsigned long _period;
+	/// Whether the first poll has set the start of the cadence.
+	bool _started;
+	unsigned long _due;
+	byte _number;
+	unsigned int _accInterval;
+	unsigned int _decInterval;
+};
+
+#endif
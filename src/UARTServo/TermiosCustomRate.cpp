@@ -0,0 +1,24 @@
+#include "TermiosTransport.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+// The kernel layout of struct termios2 differs by architecture, it comes from the kernel headers
+// in a translation unit of its own, since they clash with <termios.h>.
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+bool TermiosTransport::configureCustomRate(unsigned long baud)
+{
+	struct termios2 tty;
+	if (ioctl(_fd, TCGETS2, &tty) != 0)
+	{
+		return false;
+	}
+	tty.c_cflag &= ~CBAUD;
+	tty.c_cflag |= BOTHER;
+	tty.c_ispeed = baud;
+	tty.c_ospeed = baud;
+	return ioctl(_fd, TCSETS2, &tty) == 0;
+}
+
+#endif
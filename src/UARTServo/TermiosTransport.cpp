@@ -0,0 +1,205 @@
+#include "TermiosTransport.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t speedOf(unsigned long baud)
+{
+	switch (baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		default: return B0;
+	}
+}
+
+TermiosTransport::TermiosTransport(const char* device)
+	: _fd(-1), _device(device), _backlogLength(0)
+{
+}
+
+TermiosTransport::~TermiosTransport()
+{
+	end();
+}
+
+bool TermiosTransport::begin(unsigned long baud)
+{
+	if (_fd < 0)
+	{
+		if (_device == NULL)
+		{
+			return false;
+		}
+		_fd = open(_device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (_fd < 0)
+		{
+			return false;
+		}
+	}
+	if (!configure(baud))
+	{
+		end();
+		return false;
+	}
+	return true;
+}
+
+void TermiosTransport::end()
+{
+	if (_fd >= 0)
+	{
+		close(_fd);
+		_fd = -1;
+	}
+	_backlogLength = 0;
+}
+
+size_t TermiosTransport::available()
+{
+	int count = 0;
+	if (_fd < 0 || ioctl(_fd, FIONREAD, &count) < 0)
+	{
+		return 0;
+	}
+	return count;
+}
+
+size_t TermiosTransport::read(byte* dest, size_t size)
+{
+	if (_fd < 0)
+	{
+		return 0;
+	}
+	ssize_t count;
+	do
+	{
+		count = ::read(_fd, dest, size);
+	} while (count < 0 && errno == EINTR);
+	return (count > 0) ? count : 0;
+}
+
+size_t TermiosTransport::write(const byte* src, size_t size)
+{
+	if (_fd < 0)
+	{
+		return 0;
+	}
+	// Bytes behind a backlog wait for it, so that the order on the wire is kept.
+	size_t written = (writePending() == 0) ? writeNow(src, size) : 0;
+	size_t count = size - written;
+	if (count > TERMIOS_BACKLOG_SIZE - _backlogLength)
+	{
+		count = TERMIOS_BACKLOG_SIZE - _backlogLength;
+	}
+	memcpy(_backlog + _backlogLength, src + written, count);
+	_backlogLength += count;
+	return written + count;
+}
+
+size_t TermiosTransport::getPending() const
+{
+	return _backlogLength;
+}
+
+size_t TermiosTransport::writePending()
+{
+	if (_backlogLength > 0)
+	{
+		size_t written = writeNow(_backlog, _backlogLength);
+		_backlogLength -= written;
+		memmove(_backlog, _backlog + written, _backlogLength);
+	}
+	return _backlogLength;
+}
+
+size_t TermiosTransport::writeNow(const byte* src, size_t size)
+{
+	size_t written = 0;
+	while (_fd >= 0 && written < size)
+	{
+		ssize_t count = ::write(_fd, src + written, size - written);
+		if (count > 0)
+		{
+			written += count;
+		}
+		else if (!(count < 0 && errno == EINTR))
+		{
+			// The kernel buffer is full(EAGAIN), or the device failed.
+			break;
+		}
+	}
+	return written;
+}
+
+int TermiosTransport::getFileDescriptor() const
+{
+	return _fd;
+}
+
+void TermiosTransport::drain()
+{
+	// The backlog is sent at the rate it has been written for.
+	while (writePending() > 0)
+	{
+		struct pollfd fds = { _fd, POLLOUT, 0 };
+		if (poll(&fds, 1, TERMIOS_DRAIN_TIMEOUT) <= 0 || (fds.revents & POLLOUT) == 0)
+		{
+			break;
+		}
+	}
+	_backlogLength = 0;
+	tcdrain(_fd);
+}
+
+bool TermiosTransport::configure(unsigned long baud)
+{
+	drain();
+
+	struct termios tty;
+	if (tcgetattr(_fd, &tty) != 0)
+	{
+		return false;
+	}
+	cfmakeraw(&tty);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
+
+	speed_t speed = speedOf(baud);
+	if (speed != B0)
+	{
+		cfsetispeed(&tty, speed);
+		cfsetospeed(&tty, speed);
+	}
+	if (tcsetattr(_fd, TCSANOW, &tty) != 0)
+	{
+		return false;
+	}
+
+	if (speed == B0 && !configureCustomRate(baud))
+	{
+		return false;
+	}
+
+	// Bytes received at the old rate are noise at the new one.
+	tcflush(_fd, TCIFLUSH);
+	return true;
+}
+
+#endif
@@ -0,0 +1,84 @@
+// TermiosTransport.h
+
+#ifndef TERMIOSTRANSPORT_H
+#define TERMIOSTRANSPORT_H
+
+#include "UARTTransport.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+/// Bytes kept for sending while the kernel buffer of the device is full.
+#ifndef TERMIOS_BACKLOG_SIZE
+#define TERMIOS_BACKLOG_SIZE	4096
+#endif
+
+/// Longest wait for the device to take more of the backlog before a rate change(unit: millisecond).
+#ifndef TERMIOS_DRAIN_TIMEOUT
+#define TERMIOS_DRAIN_TIMEOUT	100
+#endif
+
+/*!
+ * TermiosTransport class
+ * Transport over a POSIX serial device (e.g. /dev/ttyUSB0) in raw, non-blocking mode.
+ * Supports every rate of UserParameter::baudIndex, up to 500000.
+ * Writes never block: bytes the kernel does not take wait in a backlog of TERMIOS_BACKLOG_SIZE bytes,
+ * sent by writePending() or the next write().
+ */
+class TermiosTransport : public UARTTransport
+{
+public:
+	/*!
+	 * \param device Path of the serial device, the string must stay valid while the transport is used.
+	 */
+	TermiosTransport(const char* device = NULL);
+	~TermiosTransport();
+
+	bool begin(unsigned long baud);
+	void end();
+	size_t available();
+	size_t read(byte* dest, size_t size);
+	size_t write(const byte* src, size_t size);
+	size_t getPending() const;
+	size_t writePending();
+
+	/*!
+	 * File descriptor of the opened device, -1 if it is closed.
+	 */
+	int getFileDescriptor() const;
+
+protected:
+	int _fd;
+
+	/*!
+	 * Put the opened descriptor into raw mode at the given rate.
+	 * The bytes not sent yet are sent at the old rate first, the bytes received are dropped.
+	 */
+	bool configure(unsigned long baud);
+
+	/*!
+	 * Set a rate without a Bxxx constant, e.g. 250000, through struct termios2.
+	 * It is defined in TermiosCustomRate.cpp, the kernel headers declaring termios2 can not be included with <termios.h>.
+	 */
+	bool configureCustomRate(unsigned long baud);
+
+private:
+	const char* _device;
+	byte _backlog[TERMIOS_BACKLOG_SIZE];
+	size_t _backlogLength;
+
+	/*!
+	 * Write as much as the kernel takes without blocking.
+	 *
+	 * \return Number of bytes written.
+	 */
+	size_t writeNow(const byte* src, size_t size);
+
+	/*!
+	 * Send the backlog and wait until the device has transmitted it.
+	 */
+	void drain();
+};
+
+#endif
+
+#endif
@@ -1,126 +1,503 @@
 #include "UARTServo.h"
 
-#define BUFFER_SIZE			256
-
-#define REQUEST_HEADER		0x4c12
-#define RESPONSE_HEADER		0x1c05
-
-#define PING				1
-#define RESET_USER_DATA		2
-#define READ_DATA			3
-#define WRITE_DATA			4
-#define READ_BATCH_DATA		5
-#define WRITE_BATCH_DATA	6
-#define SPIN				7
-#define ROTATE				8
-#define DAMPING				9
-#define READ_ANGLE			10
-#define ROTATE_BY_INTERVAL	11
-#define ROTATE_BY_VELOCITY	12
-
-#define CALLBACK(c, ...) if (c != NULL) { c(__VA_ARGS__); c = NULL; }
+#define READ_CHUNK_SIZE		64
+
+UARTServo::UARTServo()
+	: _transport(NULL), _baud(BAUD_RATE), _timeout(REQUEST_TIMEOUT), _retries(0), _timeoutCallback(NULL), _timeoutContextCallback(NULL), _timeoutContext(NULL), _tasks(NULL), _capture(NULL)
+{
+#ifdef SOFTWARE_SERIAL
+	_softwareSerial = NULL;
+#endif
+#ifdef SERVO_STATISTICS
+	clearStatistics();
+#endif
+}
 
 void UARTServo::begin(unsigned int rxPin, unsigned int txPin, unsigned long baud)
 {
 #ifdef SOFTWARE_SERIAL
-	init();
-	_serial = new SoftwareSerial(rxPin, txPin);
-	_serial->begin(baud);
+	if (_softwareSerial != NULL)
+	{
+		_softwareSerial->~SoftwareSerial();
+	}
+	_softwareSerial = new (_softwareSerialStorage) SoftwareSerial(rxPin, txPin);
+	_softwareTransport.attach(_softwareSerial);
+	begin(&_softwareTransport, baud);
+#else
+	(void)rxPin;
+	(void)txPin;
+	(void)baud;
 #endif
 }
 
+#ifdef ARDUINO
 void UARTServo::begin(HardwareSerial* serial, unsigned long baud)
+{
+	_hardwareTransport.attach(serial);
+	begin(&_hardwareTransport, baud);
+}
+#endif
+
+bool UARTServo::begin(UARTTransport* transport, unsigned long baud)
 {
 	init();
-	_serial = serial;
-	_serial->begin(baud);
+	_transport = transport;
+	_baud = baud;
+	return _transport->begin(baud);
+}
+
+bool UARTServo::setBaudRate(unsigned long baud)
+{
+	// Bytes of a partial frame were sent at the old rate.
+	_parser.reset();
+	_baud = baud;
+	return _transport->begin(baud);
 }
 
 void UARTServo::init()
 {
-	_txBuffer.init(BUFFER_SIZE);
-	_rxBuffer.init(BUFFER_SIZE);
-	_pingCallback = NULL;
-	_resetUserDataCallback = NULL;
-	_readDataCallback = NULL;
-	_writeDataCallback = NULL;
-	_readBatchDataCallback = NULL;
-	_writeBatchDataCallback = NULL;
-	_spinCallback = NULL;
-	_rotateCallback = NULL;
-	_dampingCallback = NULL;
-	_readAngleCallback = NULL;
+	_parser.reset();
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		_pendingRequests[i].number = 0;
+	}
+	_sequence = 0;
 }
 
 void UARTServo::update()
 {
-	while (_serial->available() != 0)
+	onReadable();
+	onWritable();
+	onDeadline();
+}
+
+void UARTServo::onReadable()
+{
+	byte chunk[READ_CHUNK_SIZE];
+	size_t count;
+	while ((count = _transport->read(chunk, sizeof(chunk))) > 0)
+	{
+		if (_capture != NULL)
+		{
+			_capture->record(CAPTURE_RX, chunk, count);
+		}
+		feed(chunk, count);
+	}
+}
+
+void UARTServo::onWritable()
+{
+	_transport->writePending();
+}
+
+void UARTServo::onDeadline()
+{
+	unsigned long now = millis();
+	checkPendingRequests(now);
+	for (UARTServoTask* task = _tasks; task != NULL; task = task->_next)
+	{
+		task->poll(*this, now);
+	}
+}
+
+long UARTServo::getPollTimeout() const
+{
+	unsigned long now = millis();
+	unsigned long delay = POLL_IDLE;
+	if (_timeout != 0)
+	{
+		for (byte i = 0; i < PENDING_REQUESTS; i++)
+		{
+			const PendingRequest* request = &_pendingRequests[i];
+			if (request->number != 0)
+			{
+				long left = (long)(request->deadline - now);
+				if (left <= 0)
+				{
+					return 0;
+				}
+				if ((unsigned long)left < delay)
+				{
+					delay = left;
+				}
+			}
+		}
+	}
+	for (const UARTServoTask* task = _tasks; task != NULL; task = task->_next)
+	{
+		unsigned long taskDelay = task->getPollDelay(now);
+		if (taskDelay < delay)
+		{
+			delay = taskDelay;
+		}
+	}
+	if (delay == POLL_IDLE)
+	{
+		return -1;
+	}
+	// Keep the value in the range of a timeout of poll().
+	return (delay < 0x7fffffffUL) ? (long)delay : 0x7fffffffL;
+}
+
+bool UARTServo::isWritePending() const
+{
+	return _transport->getPending() > 0;
+}
+
+#ifndef ARDUINO
+int UARTServo::getFileDescriptor() const
+{
+	return _transport->getFileDescriptor();
+}
+#endif
+
+void UARTServo::attach(UARTServoTask* task)
+{
+	detach(task);
+	task->_next = _tasks;
+	_tasks = task;
+}
+
+void UARTServo::detach(UARTServoTask* task)
+{
+	for (UARTServoTask** p = &_tasks; *p != NULL; p = &(*p)->_next)
+	{
+		if (*p == task)
+		{
+			*p = task->_next;
+			task->_next = NULL;
+			break;
+		}
+	}
+}
+
+bool UARTServo::sendRequest(byte number, const byte* payload, byte size, ResponseHandler* handler)
+{
+	// No servo replies to a broadcast, it is sent untracked.
+	if (handler != NULL && payload[0] != ALL_SERVOS)
+	{
+		PendingRequest* request = addPendingRequest(payload[0], number, (size > 1) ? payload[1] : 0);
+		if (request == NULL)
+		{
+			return false;
+		}
+		request->handler = handler;
+	}
+	FrameWriter frame(_txFrame, sizeof(_txFrame));
+	frame.begin(REQUEST_HEADER, number, size);
+	frame.write(payload, size);
+	writeSerialData(frame.getData(), frame.end());
+	return true;
+}
+
+bool UARTServo::cancelRequest(byte id, byte number, ResponseHandler* handler)
+{
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		PendingRequest* request = &_pendingRequests[i];
+		if (request->number == number && request->id == id && request->handler == handler)
+		{
+			request->number = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+byte UARTServo::getFreeRequestSlots() const
+{
+	byte count = 0;
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		if (_pendingRequests[i].number == 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+unsigned long UARTServo::getBaudRate() const
+{
+	return _baud;
+}
+
+unsigned long UARTServo::getBaudRate(byte baudIndex)
+{
+	static const unsigned long BAUD_RATES[] = { 0, 9600, 19200, 38400, 57600, 115200, 250000, 500000 };
+	return (baudIndex < sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0])) ? BAUD_RATES[baudIndex] : 0;
+}
+
+unsigned long UARTServo::getWireTime(unsigned int size) const
+{
+	// Start bit, 8 data bits and stop bit. The rates are multiples of 100, which keeps it in 32 bits.
+	// Rates under 100 are taken as 100, no servo runs that slow.
+	unsigned long rate = (_baud >= 100) ? _baud / 100 : 1;
+	return ((unsigned long)size * 100000UL + rate - 1) / rate;
+}
+
+void UARTServo::setTimeout(unsigned long timeout, byte retries)
+{
+	bool changed = timeout != _timeout;
+	_timeout = timeout;
+	_retries = retries;
+	if (!changed)
+	{
+		return;
+	}
+	// Deadlines were stamped with the old timeout, e.g. already passed for requests sent without one.
+	unsigned long now = millis();
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		PendingRequest* request = &_pendingRequests[i];
+		if (request->number != 0)
+		{
+			request->deadline = now + getRetryWait(request->attempts);
+		}
+	}
+}
+
+void UARTServo::setTimeoutCallback(void(*callback)(byte, byte))
+{
+	_timeoutCallback = callback;
+	_timeoutContextCallback = NULL;
+}
+
+void UARTServo::setTimeoutCallback(void(*callback)(void*, byte, byte), void* context)
+{
+	_timeoutCallback = NULL;
+	_timeoutContextCallback = callback;
+	_timeoutContext = context;
+}
+
+void UARTServo::setCapture(BusCapture* capture)
+{
+	_capture = capture;
+}
+
+#ifdef SERVO_STATISTICS
+void UARTServo::getStatistics(ServoStatistics* statistics) const
+{
+	*statistics = _statistics;
+	statistics->checksumErrors = _parser.getChecksumErrors();
+	statistics->discardedBytes = _parser.getDiscardedBytes();
+}
+
+void UARTServo::clearStatistics()
+{
+	memset(&_statistics, 0, sizeof(_statistics));
+	_parser.clearStatistics();
+}
+#endif
+
+bool UARTServo::ping(byte id, void(*callback)(byte))
+{
+	if (!addPendingRequest(id, PACKET_PING, callback))
+	{
+		return false;
+	}
+	RequestFrame<PACKET_PING, 1> frame;
+	frame.put<0>(id);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
+}
+
+bool UARTServo::ping(byte id, void(*callback)(void*, byte), void* context)
+{
+	// The request is tracked with the context here, the other form then sends it untracked.
+	return addPendingRequest(id, PACKET_PING, callback, context) && ping(id, NULL);
+}
+
+bool UARTServo::resetUserData(byte id, void(*callback)(byte, byte))
+{
+	if (!addPendingRequest(id, PACKET_RESET_USER_DATA, callback))
+	{
+		return false;
+	}
+	RequestFrame<PACKET_RESET_USER_DATA, 1> frame;
+	frame.put<0>(id);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
+}
+
+bool UARTServo::resetUserData(byte id, void(*callback)(void*, byte, byte), void* context)
+{
+	return addPendingRequest(id, PACKET_RESET_USER_DATA, callback, context) && resetUserData(id, NULL);
+}
+
+bool UARTServo::readData(byte id, byte dataID, void(*callback)(byte, byte, const void *))
+{
+	if (!addPendingRequest(id, PACKET_READ_DATA, callback, dataID))
+	{
+		return false;
+	}
+	sendReadData(id, dataID);
+	return true;
+}
+
+bool UARTServo::readData(byte id, byte dataID, void(*callback)(void*, byte, byte, const void*), void* context)
+{
+	return addPendingRequest(id, PACKET_READ_DATA, callback, context, dataID) && readData(id, dataID, NULL);
+}
+
+// The callback of a typed read is tracked like the others, with the typed flag set.
+#define READ_TYPED_DATA(member) \
+	if (callback != NULL && id != ALL_SERVOS) \
+	{ \
+		PendingRequest* request = addPendingRequest(id, PACKET_READ_DATA, dataID); \
+		if (request == NULL) \
+		{ \
+			return false; \
+		} \
+		request->callback.member = callback; \
+		request->typed = true; \
+	} \
+	sendReadData(id, dataID); \
+	return true;
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(byte, byte))
+{
+	READ_TYPED_DATA(readByte)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(byte, unsigned int))
+{
+	READ_TYPED_DATA(readUInt)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(byte, int))
+{
+	READ_TYPED_DATA(readInt)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(byte, unsigned long))
+{
+	READ_TYPED_DATA(readULong)
+}
+
+#define READ_TYPED_CONTEXT_DATA(member) \
+	if (callback != NULL && id != ALL_SERVOS) \
+	{ \
+		PendingRequest* request = addPendingRequest(id, PACKET_READ_DATA, dataID); \
+		if (request == NULL) \
+		{ \
+			return false; \
+		} \
+		request->callback.member = callback; \
+		request->typed = true; \
+		request->contextual = true; \
+		request->context = context; \
+	} \
+	sendReadData(id, dataID); \
+	return true;
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(void*, byte, byte), void* context)
+{
+	READ_TYPED_CONTEXT_DATA(readByteContext)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(void*, byte, unsigned int), void* context)
+{
+	READ_TYPED_CONTEXT_DATA(readUIntContext)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(void*, byte, int), void* context)
+{
+	READ_TYPED_CONTEXT_DATA(readIntContext)
+}
+
+bool UARTServo::readTypedData(byte id, byte dataID, void(*callback)(void*, byte, unsigned long), void* context)
+{
+	READ_TYPED_CONTEXT_DATA(readULongContext)
+}
+
+void UARTServo::sendReadData(byte id, byte dataID)
+{
+	RequestFrame<PACKET_READ_DATA, 2> frame;
+	frame.put<0>(id);
+	frame.put<1>(dataID);
+	writeSerialData(frame.seal(), frame.LENGTH);
+}
+
+bool UARTServo::writeData(byte id, byte dataID, const void * data, size_t size, void(*callback)(byte, byte, byte))
+{
+	if (!addPendingRequest(id, PACKET_WRITE_DATA, callback, dataID))
 	{
-		handleByteFromServo(_serial->read());
+		return false;
 	}
+	// The data table knows the wire size of its fields.
+	byte dataSize = getDataSize(dataID);
+	if (dataSize > 0 && dataSize < size)
+	{
+		size = dataSize;
+	}
+	FrameWriter frame(_txFrame, sizeof(_txFrame));
+	frame.begin(REQUEST_HEADER, PACKET_WRITE_DATA, size + 2);
+	frame.write(id);
+	frame.write(dataID);
+	frame.write(data, size);
+	writeSerialData(frame.getData(), frame.end());
+	return true;
 }
 
-void UARTServo::ping(byte id, void(*callback)(byte))
+bool UARTServo::writeData(byte id, byte dataID, const void* data, size_t size, void(*callback)(void*, byte, byte, byte), void* context)
 {
-	_pingCallback = callback;
-	makeHeader(PING, 1);
-	_txBuffer.write(id);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_WRITE_DATA, callback, context, dataID) && writeData(id, dataID, data, size, NULL);
 }
 
-void UARTServo::resetUserData(byte id, void(*callback)(byte, byte))
+bool UARTServo::readBatchData(byte id, void(*callback)(byte, const UserParameter *))
 {
-	_resetUserDataCallback = callback;
-	makeHeader(RESET_USER_DATA, 1);
-	_txBuffer.write(id);
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_READ_BATCH_DATA, callback))
+	{
+		return false;
+	}
+	RequestFrame<PACKET_READ_BATCH_DATA, 1> frame;
+	frame.put<0>(id);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
 }
 
-void UARTServo::readData(byte id, byte dataID, void(*callback)(byte, byte, const void *))
+bool UARTServo::readBatchData(byte id, void(*callback)(void*, byte, const UserParameter*), void* context)
 {
-	_readDataCallback = callback;
-	makeHeader(READ_DATA, 2);
-	_txBuffer.write(id);
-	_txBuffer.write(dataID);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_READ_BATCH_DATA, callback, context) && readBatchData(id, NULL);
 }
 
-void UARTServo::writeData(byte id, byte dataID, const void * data, size_t size, void(*callback)(byte, byte, byte))
+bool UARTServo::writeBatchData(byte id, const UserParameter * parameter, void(*callback)(byte, byte))
 {
-	_writeDataCallback = callback;
-	makeHeader(WRITE_DATA, size + 2);
-	_txBuffer.write(id);
-	_txBuffer.write(dataID);
-	_txBuffer.write(data, size);
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_WRITE_BATCH_DATA, callback))
+	{
+		return false;
+	}
+	FrameWriter frame(_txFrame, sizeof(_txFrame));
+	frame.begin(REQUEST_HEADER, PACKET_WRITE_BATCH_DATA, 1 + USER_DATA_SIZE);
+	frame.write(id);
+	byte data[USER_DATA_SIZE];
+	encodeUserParameter(parameter, data);
+	frame.write(data, USER_DATA_SIZE);
+	writeSerialData(frame.getData(), frame.end());
+	return true;
 }
 
-void UARTServo::readBatchData(byte id, void(*callback)(byte, const UserParameter *))
+bool UARTServo::writeBatchData(byte id, const UserParameter* parameter, void(*callback)(void*, byte, byte), void* context)
 {
-	_readBatchDataCallback = callback;
-	makeHeader(READ_BATCH_DATA, 1);
-	_txBuffer.write(id);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_WRITE_BATCH_DATA, callback, context) && writeBatchData(id, parameter, NULL);
 }
 
-void UARTServo::writeBatchData(byte id, const UserParameter * parameter, void(*callback)(byte, byte))
+bool UARTServo::spin(byte id, byte method, unsigned int speed, unsigned int value, void(*callback)(byte, byte))
 {
-	_writeBatchDataCallback = callback;
-	makeHeader(WRITE_BATCH_DATA, 1 + sizeof(parameter));
-	_txBuffer.write(id);
-	_txBuffer.write(parameter, sizeof(parameter));
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_SPIN, callback))
+	{
+		return false;
+	}
+	SpinFrame frame;
+	encodeSpin(frame, id, method, speed, value);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
 }
 
-void UARTServo::spin(byte id, byte method, unsigned int speed, unsigned int value, void(*callback)(byte, byte))
+bool UARTServo::spin(byte id, byte method, unsigned int speed, unsigned int value, void(*callback)(void*, byte, byte), void* context)
 {
-	_spinCallback = callback;
-	makeHeader(SPIN, 6);
-	_txBuffer.write(id);
-	_txBuffer.write(method);
-	_txBuffer.writeUInt(speed);
-	_txBuffer.writeUInt(value);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_SPIN, callback, context) && spin(id, method, speed, value, NULL);
 }
 
 void UARTServo::stop(byte id)
@@ -128,215 +505,651 @@ void UARTServo::stop(byte id)
 	spin(id, SPIN_STOP);
 }
 
-void UARTServo::rotate(byte id, int angle, unsigned int interval, unsigned int power, void(*callback)(byte, byte))
+bool UARTServo::rotate(byte id, int angle, unsigned int interval, unsigned int power, void(*callback)(byte, byte))
 {
-	_rotateCallback = callback;
-	makeHeader(ROTATE, 7);
-	_txBuffer.write(id);
-	_txBuffer.writeInt(angle);
-	_txBuffer.writeUInt(interval);
-	_txBuffer.writeUInt(power);
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_ROTATE, callback))
+	{
+		return false;
+	}
+	RotateFrame frame;
+	encodeRotate(frame, id, angle, interval, power);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
 }
 
-void UARTServo::rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(byte, byte))
+bool UARTServo::rotate(byte id, int angle, unsigned int interval, unsigned int power, void(*callback)(void*, byte, byte), void* context)
 {
-	_rotateByIntervalCallback = callback;
-	makeHeader(ROTATE_BY_INTERVAL, 11);
-	_txBuffer.write(id);
-	_txBuffer.writeInt(angle);
-	_txBuffer.writeUInt(interval);
-	_txBuffer.writeUInt(accInterval);
-	_txBuffer.writeUInt(decInterval);
-	_txBuffer.writeUInt(power);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_ROTATE, callback, context) && rotate(id, angle, interval, power, NULL);
 }
 
-void UARTServo::rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(byte, byte))
+bool UARTServo::rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(byte, byte))
 {
-	_rotateByVelocityCallback = callback;
-	makeHeader(ROTATE_BY_VELOCITY, 11);
-	_txBuffer.write(id);
-	_txBuffer.writeInt(angle);
-	_txBuffer.writeUInt(targetVelocity);
-	_txBuffer.writeUInt(accInterval);
-	_txBuffer.writeUInt(decInterval);
-	_txBuffer.writeUInt(power);
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_ROTATE_BY_INTERVAL, callback))
+	{
+		return false;
+	}
+	RotateByIntervalFrame frame;
+	encodeRotateBy(frame, id, angle, interval, accInterval, decInterval, power);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
 }
 
-void UARTServo::damping(byte id, unsigned int power, void(*callback)(byte, byte))
+bool UARTServo::rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(void*, byte, byte), void* context)
 {
-	_dampingCallback = callback;
-	makeHeader(DAMPING, 3);
-	_txBuffer.write(id);
-	_txBuffer.writeUInt(power);
-	writeSerialData();
+	return addPendingRequest(id, PACKET_ROTATE_BY_INTERVAL, callback, context) && rotateByInterval(id, angle, interval, accInterval, decInterval, power, NULL);
 }
 
-void UARTServo::readAngle(byte id, void(*callback)(byte, int))
+bool UARTServo::rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(byte, byte))
 {
-	_readAngleCallback = callback;
-	makeHeader(READ_ANGLE, 1);
-	_txBuffer.write(id);
-	writeSerialData();
+	if (!addPendingRequest(id, PACKET_ROTATE_BY_VELOCITY, callback))
+	{
+		return false;
+	}
+	RotateByVelocityFrame frame;
+	encodeRotateBy(frame, id, angle, targetVelocity, accInterval, decInterval, power);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
+}
+
+bool UARTServo::rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(void*, byte, byte), void* context)
+{
+	return addPendingRequest(id, PACKET_ROTATE_BY_VELOCITY, callback, context) && rotateByVelocity(id, angle, targetVelocity, accInterval, decInterval, power, NULL);
 }
 
-void UARTServo::handleByteFromServo(byte data)
+bool UARTServo::rotateGroup(const ServoMotion* motions, byte count, byte number, bool broadcast, void(*callback)(byte, byte))
 {
-	_rxBuffer.write(data);
+	if (!isRotateNumber(number))
+	{
+		return false;
+	}
+	if (count == 0)
+	{
+		return true;
+	}
 
-	while (_rxBuffer.getLength() >= 5) // 5 for header & checksum.
+	if (broadcast && isSameMotion(motions, count))
 	{
-		if (_rxBuffer.readUInt() == RESPONSE_HEADER)
+		// No servo replies to a broadcast, the callback is not called.
+		writeSerialData(_txFrame, encodeMotion(_txFrame, sizeof(_txFrame), number, ALL_SERVOS, motions[0]));
+		return true;
+	}
+
+	bool result = true;
+	size_t length = 0;
+	for (byte i = 0; i < count; i++)
+	{
+		if (!addPendingRequest(motions[i].id, number, callback))
+		{
+			result = false;
+			break;
+		}
+		size_t size = encodeMotion(_txFrame + length, sizeof(_txFrame) - length, number, motions[i].id, motions[i]);
+		if (size == 0)
 		{
-			byte packetNumber = _rxBuffer.read();
-			byte packetLength = _rxBuffer.read();
+			// The buffer is full, send it and start over.
+			writeSerialData(_txFrame, length);
+			length = 0;
+			size = encodeMotion(_txFrame, sizeof(_txFrame), number, motions[i].id, motions[i]);
+		}
+		length += size;
+	}
+	if (length > 0)
+	{
+		writeSerialData(_txFrame, length);
+	}
+	return result;
+}
 
-			_rxBuffer.back(4);
+bool UARTServo::rotateGroup(const ServoMotion* motions, byte count, byte number, bool broadcast, void(*callback)(void*, byte, byte), void* context)
+{
+	if (!isRotateNumber(number))
+	{
+		return false;
+	}
+	if (count == 0)
+	{
+		return true;
+	}
+	if (broadcast && isSameMotion(motions, count))
+	{
+		return rotateGroup(motions, count, number, true);
+	}
+	// As in the other form, the motions after the first one without room in the pending-request table are not sent.
+	byte tracked = 0;
+	while (tracked < count && addPendingRequest(motions[tracked].id, number, callback, context))
+	{
+		tracked++;
+	}
+	rotateGroup(motions, tracked, number, false);
+	return tracked == count;
+}
+
+bool UARTServo::isRotateNumber(byte number)
+{
+	return number == PACKET_ROTATE || number == PACKET_ROTATE_BY_INTERVAL || number == PACKET_ROTATE_BY_VELOCITY;
+}
+
+bool UARTServo::isSameMotion(const ServoMotion* motions, byte count)
+{
+	for (byte i = 1; i < count; i++)
+	{
+		if (motions[i].angle != motions[0].angle || motions[i].interval != motions[0].interval
+			|| motions[i].accInterval != motions[0].accInterval || motions[i].decInterval != motions[0].decInterval
+			|| motions[i].power != motions[0].power)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool UARTServo::damping(byte id, unsigned int power, void(*callback)(byte, byte))
+{
+	if (!addPendingRequest(id, PACKET_DAMPING, callback))
+	{
+		return false;
+	}
+	DampingFrame frame;
+	encodeDamping(frame, id, power);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
+}
+
+bool UARTServo::damping(byte id, unsigned int power, void(*callback)(void*, byte, byte), void* context)
+{
+	return addPendingRequest(id, PACKET_DAMPING, callback, context) && damping(id, power, NULL);
+}
+
+bool UARTServo::readAngle(byte id, void(*callback)(byte, int))
+{
+	if (!addPendingRequest(id, PACKET_READ_ANGLE, callback))
+	{
+		return false;
+	}
+	RequestFrame<PACKET_READ_ANGLE, 1> frame;
+	frame.put<0>(id);
+	writeSerialData(frame.seal(), frame.LENGTH);
+	return true;
+}
+
+bool UARTServo::readAngle(byte id, void(*callback)(void*, byte, int), void* context)
+{
+	return addPendingRequest(id, PACKET_READ_ANGLE, callback, context) && readAngle(id, NULL);
+}
+
+void UARTServo::feed(const byte* data, size_t size)
+{
+	while (size > 0)
+	{
+		size_t count = _parser.parse(data, size);
+		if (_parser.isComplete())
+		{
+			handleFrameFromServo(_parser.getNumber(), _parser.getPayload(), _parser.getLength());
+		}
+		data += count;
+		size -= count;
+	}
+}
+
+// Call the callback of a pending request, with the context pointer first if it takes one.
+#define INVOKE_CALLBACK(member, ...) \
+	if (request.contextual) \
+	{ \
+		request.callback.member##Context(request.context, __VA_ARGS__); \
+	} \
+	else \
+	{ \
+		request.callback.member(__VA_ARGS__); \
+	}
+
+void UARTServo::handleFrameFromServo(byte number, const byte* payload, byte length)
+{
+	if (length == 0)
+	{
+		return;
+	}
+	// Every response starts with the servo ID.
+	PendingRequest request;
+	bool pending = takePendingRequest(number, payload, length, &request);
+#ifdef SERVO_STATISTICS
+	countResponse(number, pending ? &request : NULL);
+#endif
+	if (!pending)
+	{
+		return;
+	}
+	if (request.handler != NULL)
+	{
+		request.handler->onResponse(payload[0], number, payload, length);
+		return;
+	}
 
-			if (_rxBuffer.getLength() >= packetLength + 5) // + 5 for header & checksum.
+	FrameReader reader(payload, length);
+	switch (number)
+	{
+		case PACKET_PING:
+		{
+			byte id = reader.read();
+			INVOKE_CALLBACK(ping, id)
+			break;
+		}
+		case PACKET_RESET_USER_DATA:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_READ_DATA:
+		{
+			byte id = reader.read();
+			byte dataID = reader.read();
+			byte dataSize = getDataSize(dataID);
+			if (dataSize > 0 && reader.getRemaining() != dataSize)
 			{
-				// Do checksum.
-				if (_rxBuffer.checksum())
-				{
-					// Pass header.
-					_rxBuffer.forward(4);
-
-					switch (packetNumber)
-					{
-						case PING:
-						{
-							byte id = _rxBuffer.read();
-							CALLBACK(_pingCallback, id);
-							break;
-						}
-						case RESET_USER_DATA:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_resetUserDataCallback, id, result);
-							break;
-						}
-						case READ_DATA:
-						{
-							size_t size = packetLength - 2;
-							byte id = _rxBuffer.read();
-							byte dataID = _rxBuffer.read();
-							byte* value = new byte[size];
-							_rxBuffer.read(value, size);
-							CALLBACK(_readDataCallback, id, dataID, value);
-							delete[] value;
-							break;
-						}
-						case WRITE_DATA:
-						{
-							byte id = _rxBuffer.read();
-							byte dataID = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_writeDataCallback, id, dataID, result);
-							break;
-						}
-						case READ_BATCH_DATA:
-						{
-							UserParameter p;
-							byte id = _rxBuffer.read();
-							_rxBuffer.read(&p, sizeof(p));
-							CALLBACK(_readBatchDataCallback, id, &p);
-							break;
-						}
-						case WRITE_BATCH_DATA:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_writeBatchDataCallback, id, result);
-							break;
-						}
-						case SPIN:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_spinCallback, id, result);
-							break;
-						}
-						case ROTATE:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_rotateCallback, id, result);
-							break;
-						}
-						case DAMPING:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_dampingCallback, id, result);
-							break;
-						}
-						case READ_ANGLE:
-						{
-							byte id = _rxBuffer.read();
-							int angle = _rxBuffer.readInt();
-							CALLBACK(_readAngleCallback, id, angle);
-							break;
-						}
-						case ROTATE_BY_INTERVAL:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_rotateByIntervalCallback, id, result);
-							break;
-						}
-						case ROTATE_BY_VELOCITY:
-						{
-							byte id = _rxBuffer.read();
-							byte result = _rxBuffer.read();
-							CALLBACK(_rotateByVelocityCallback, id, result);
-							break;
-						}
-						default:
-						{
-							// Destroy all content.
-							_rxBuffer.forward(packetLength);
-							break;
-						}
-					}
-
-					// Pass tail.
-					_rxBuffer.forward(1);
-				}
-				else
-				{
-					// As checksum error occurs, destroy all content.
-					_rxBuffer.forward(packetLength + 5);
-				}
+				// A malformed value of the data table, the data ID has been matched with the request.
+				reportFailure(request);
+				break;
 			}
-			else
+			if (request.typed)
 			{
+				// Only data IDs of the data table are typed, so the size has been checked.
+				dispatchTypedData(request, id, dataID, reader.getData());
 				break;
 			}
+			// The value is passed in place, its size is packet length - 2.
+			INVOKE_CALLBACK(readData, id, dataID, reader.getData())
+			break;
+		}
+		case PACKET_WRITE_DATA:
+		{
+			byte id = reader.read();
+			byte dataID = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(writeData, id, dataID, result)
+			break;
+		}
+		case PACKET_READ_BATCH_DATA:
+		{
+			byte id = reader.read();
+			if (reader.getRemaining() != USER_DATA_SIZE)
+			{
+				reportFailure(request);
+				break;
+			}
+			UserParameter p;
+			decodeUserParameter(reader.getData(), &p);
+			INVOKE_CALLBACK(readBatchData, id, &p)
+			break;
+		}
+		case PACKET_WRITE_BATCH_DATA:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_SPIN:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_ROTATE:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_DAMPING:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_READ_ANGLE:
+		{
+			byte id = reader.read();
+			int angle = reader.readInt();
+			INVOKE_CALLBACK(readAngle, id, angle)
+			break;
+		}
+		case PACKET_ROTATE_BY_INTERVAL:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		case PACKET_ROTATE_BY_VELOCITY:
+		{
+			byte id = reader.read();
+			byte result = reader.read();
+			INVOKE_CALLBACK(result, id, result)
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+UARTServo::PendingRequest* UARTServo::addPendingRequest(byte id, byte number, byte argument)
+{
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		PendingRequest* request = &_pendingRequests[i];
+		if (request->number == 0)
+		{
+			request->number = number;
+			request->id = id;
+			request->sequence = _sequence++;
+			request->attempts = 0;
+			request->argument = argument;
+			request->typed = false;
+			request->contextual = false;
+			request->context = NULL;
+			request->deadline = millis() + _timeout;
+#ifdef SERVO_STATISTICS
+			request->sent = micros();
+#endif
+			request->handler = NULL;
+			return request;
+		}
+	}
+	return NULL;
+}
+
+// Requests without callback are not tracked, they are always sent.
+#define ADD_PENDING_REQUEST(member) \
+	if (callback == NULL || id == ALL_SERVOS) \
+	{ \
+		return true; \
+	} \
+	PendingRequest* request = addPendingRequest(id, number, argument); \
+	if (request == NULL) \
+	{ \
+		return false; \
+	} \
+	request->callback.member = callback; \
+	return true;
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte), byte argument)
+{
+	ADD_PENDING_REQUEST(ping)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte, byte), byte argument)
+{
+	ADD_PENDING_REQUEST(result)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte, byte, const void*), byte argument)
+{
+	ADD_PENDING_REQUEST(readData)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte, byte, byte), byte argument)
+{
+	ADD_PENDING_REQUEST(writeData)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte, const UserParameter*), byte argument)
+{
+	ADD_PENDING_REQUEST(readBatchData)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(byte, int), byte argument)
+{
+	ADD_PENDING_REQUEST(readAngle)
+}
+
+#define ADD_CONTEXT_PENDING_REQUEST(member) \
+	if (callback == NULL || id == ALL_SERVOS) \
+	{ \
+		return true; \
+	} \
+	PendingRequest* request = addPendingRequest(id, number, argument); \
+	if (request == NULL) \
+	{ \
+		return false; \
+	} \
+	request->callback.member = callback; \
+	request->contextual = true; \
+	request->context = context; \
+	return true;
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(pingContext)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(resultContext)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte, const void*), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(readDataContext)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte, byte), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(writeDataContext)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte, const UserParameter*), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(readBatchDataContext)
+}
+
+bool UARTServo::addPendingRequest(byte id, byte number, void(*callback)(void*, byte, int), void* context, byte argument)
+{
+	ADD_CONTEXT_PENDING_REQUEST(readAngleContext)
+}
+
+void UARTServo::dispatchTypedData(const PendingRequest& request, byte id, byte dataID, const byte* data)
+{
+	// The value is decoded in place, by the wire form the data ID has in the data table.
+	switch (getDataSize(dataID))
+	{
+		case 1:
+		{
+			INVOKE_CALLBACK(readByte, id, DataWire<1, false>::read<0>(data))
+			break;
+		}
+		case 4:
+		{
+			INVOKE_CALLBACK(readULong, id, DataWire<4, false>::read<0>(data))
+			break;
+		}
+		default:
+		{
+			if (isUserDataSigned(dataID))
+			{
+				INVOKE_CALLBACK(readInt, id, DataWire<2, true>::read<0>(data))
+			}
+			else
+			{
+				INVOKE_CALLBACK(readUInt, id, DataWire<2, false>::read<0>(data))
+			}
+			break;
+		}
+	}
+}
+
+bool UARTServo::takePendingRequest(byte number, const byte* payload, byte length, PendingRequest* request)
+{
+	// Data requests to one servo are told apart by the data ID their responses echo,
+	// so a lost response never hands the next one to another request.
+	bool keyed = number == PACKET_READ_DATA || number == PACKET_WRITE_DATA;
+	if (keyed && length < 2)
+	{
+		return false;
+	}
+	PendingRequest* oldest = NULL;
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		PendingRequest* candidate = &_pendingRequests[i];
+		if (candidate->number == number && candidate->id == payload[0] && (!keyed || candidate->argument == payload[1]))
+		{
+			if (oldest == NULL || (byte)(_sequence - candidate->sequence) > (byte)(_sequence - oldest->sequence))
+			{
+				oldest = candidate;
+			}
+		}
+	}
+	if (oldest == NULL)
+	{
+		return false;
+	}
+	// Free the slot before the callback runs, so that it can issue a new request.
+	*request = *oldest;
+	oldest->number = 0;
+	return true;
+}
+
+void UARTServo::checkPendingRequests(unsigned long now)
+{
+	if (_timeout == 0)
+	{
+		return;
+	}
+	for (byte i = 0; i < PENDING_REQUESTS; i++)
+	{
+		PendingRequest* request = &_pendingRequests[i];
+		if (request->number == 0 || (long)(now - request->deadline) < 0)
+		{
+			continue;
+		}
+
+		bool idempotent = request->number == PACKET_PING || request->number == PACKET_READ_DATA
+			|| request->number == PACKET_READ_BATCH_DATA || request->number == PACKET_READ_ANGLE;
+		if (idempotent && request->attempts < _retries)
+		{
+			// Back off, wait twice as long as the previous attempt.
+			request->attempts++;
+			request->deadline = now + getRetryWait(request->attempts);
+#ifdef SERVO_STATISTICS
+			request->sent = micros();
+			_statistics.retries++;
+#endif
+			resendPendingRequest(request);
 		}
 		else
 		{
-			// Shift 1 byte(2 bytes for header).
-			_rxBuffer.back(1);
+			// Free the slot before the callback runs, so that it can issue a new request.
+			PendingRequest failed = *request;
+			request->number = 0;
+#ifdef SERVO_STATISTICS
+			_statistics.timeouts++;
+#endif
+			reportFailure(failed);
 		}
 	}
 }
 
-void UARTServo::makeHeader(byte number, byte size)
+unsigned long UARTServo::getRetryWait(byte attempts) const
+{
+	// Saturate instead of overflowing, a deadline must stay less than half the range of millis() ahead.
+	const unsigned long longest = 0x7fffffffUL;
+	if (attempts >= 31 || _timeout > (longest >> attempts))
+	{
+		return longest;
+	}
+	return _timeout << attempts;
+}
+
+void UARTServo::reportFailure(const PendingRequest& request)
+{
+	if (request.handler != NULL)
+	{
+		request.handler->onTimeout(request.id, request.number, request.argument);
+	}
+	else if (_timeoutCallback != NULL)
+	{
+		_timeoutCallback(request.id, request.number);
+	}
+	else if (_timeoutContextCallback != NULL)
+	{
+		_timeoutContextCallback(_timeoutContext, request.id, request.number);
+	}
+}
+
+void UARTServo::resendPendingRequest(const PendingRequest* request)
+{
+	if (request->number == PACKET_READ_DATA)
+	{
+		sendReadData(request->id, request->argument);
+	}
+	else
+	{
+		// Ping, read batch data and read angle requests hold the servo ID only.
+		byte data[1 + FRAME_OVERHEAD];
+		FrameWriter frame(data, sizeof(data));
+		frame.begin(REQUEST_HEADER, request->number, 1);
+		frame.write(request->id);
+		writeSerialData(frame.getData(), frame.end());
+	}
+}
+
+#ifdef SERVO_STATISTICS
+void UARTServo::countResponse(byte number, const PendingRequest* request)
 {
-	_txBuffer.clear();
-	_txBuffer.writeUInt(REQUEST_HEADER);
-	_txBuffer.write(number);
-	_txBuffer.write(size);
+	byte index = (number < STATISTICS_PACKETS) ? number : 0;
+	_statistics.responses[index]++;
+	if (request == NULL)
+	{
+		_statistics.unexpectedResponses++;
+		return;
+	}
+	// Bucket of the latency, from its highest bit.
+	unsigned long latency = (micros() - request->sent) >> 8;
+	byte bucket = 0;
+	while (latency != 0 && bucket < LATENCY_BUCKETS - 1)
+	{
+		latency >>= 1;
+		bucket++;
+	}
+	_statistics.latency[index][bucket]++;
 }
+#endif
 
-void UARTServo::writeSerialData()
+size_t UARTServo::encodeMotion(byte* dest, size_t capacity, byte number, byte id, const ServoMotion& motion)
 {
-	_txBuffer.writeChecksum();
-	while (_txBuffer.getLength() > 0)
+	byte size = (number == PACKET_ROTATE) ? 7 : 11;
+	if (capacity < (size_t)size + FRAME_OVERHEAD)
+	{
+		return 0;
+	}
+	FrameWriter frame(dest, capacity);
+	frame.begin(REQUEST_HEADER, number, size);
+	frame.write(id);
+	frame.writeInt(motion.angle);
+	frame.writeUInt(motion.interval);
+	if (number != PACKET_ROTATE)
 	{
-		_serial->write(_txBuffer.read());
+		frame.writeUInt(motion.accInterval);
+		frame.writeUInt(motion.decInterval);
 	}
+	frame.writeUInt(motion.power);
+	return frame.end();
+}
+
+void UARTServo::writeSerialData(const byte* data, size_t size)
+{
+	if (_capture != NULL)
+	{
+		_capture->record(CAPTURE_TX, data, size);
+	}
+#ifdef SERVO_STATISTICS
+	_statistics.droppedBytes += size - _transport->write(data, size);
+#else
+	_transport->write(data, size);
+#endif
 }
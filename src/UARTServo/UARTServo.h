@@ -6,24 +6,63 @@
 // If you want to use software serial port, uncomment the following line.
 //#define SOFTWARE_SERIAL
 
-#if defined(ARDUINO) && ARDUINO >= 100
-#include "arduino.h"
-#else
-#include "WProgram.h"
-#endif
-
-#include "ByteBuffer.h"
+#include "Platform.h"
+#include "Frame.h"
+#include "FrameParser.h"
+#include "UARTTransport.h"
+#include "SerialTransport.h"
+#include "BusCapture.h"
+#include "UserData.h"
 
 #ifdef SOFTWARE_SERIAL
+#include <new>
 #include "SoftwareSerial.h"
 #endif
 
 /// Default connecting rate.
 #define BAUD_RATE				115200
 
-/// All servos.
+/// All servos. No servo replies to a request sent to all servos, so the callback of such a command is never called.
 #define ALL_SERVOS				0xff
 
+/// Maximum number of requests waiting for their responses at the same time.
+#ifndef PENDING_REQUESTS
+#define PENDING_REQUESTS		16
+#endif
+
+/// Default time to wait for a response (unit: millisecond).
+#ifndef REQUEST_TIMEOUT
+#define REQUEST_TIMEOUT			100
+#endif
+
+/// Poll delay of a task with nothing to do until a response arrives, see UARTServoTask::getPollDelay().
+#define POLL_IDLE				0xffffffffUL
+
+/// Packet number: ping.
+#define PACKET_PING					1
+/// Packet number: reset user data.
+#define PACKET_RESET_USER_DATA		2
+/// Packet number: read data.
+#define PACKET_READ_DATA			3
+/// Packet number: write data.
+#define PACKET_WRITE_DATA			4
+/// Packet number: read batch data.
+#define PACKET_READ_BATCH_DATA		5
+/// Packet number: write batch data.
+#define PACKET_WRITE_BATCH_DATA		6
+/// Packet number: spin.
+#define PACKET_SPIN					7
+/// Packet number: rotate.
+#define PACKET_ROTATE				8
+/// Packet number: damping.
+#define PACKET_DAMPING				9
+/// Packet number: read angle.
+#define PACKET_READ_ANGLE			10
+/// Packet number: rotate by interval.
+#define PACKET_ROTATE_BY_INTERVAL	11
+/// Packet number: rotate by velocity.
+#define PACKET_ROTATE_BY_VELOCITY	12
+
 /// Spin direction: counterclockwise.
 #define SPIN_CLOCKWISE			0x80
 /// Spin direction: clockwise.
@@ -38,183 +77,426 @@
 /// Spin behavior: spin by time.
 #define SPIN_BY_TIME			0x03
 
-/// Custom parameters.
-struct UserParameter
+/// Motion of one servo in a group, see UARTServo::rotateGroup().
+struct ServoMotion
+{
+	/// Servo ID.
+	byte id;
+	/// Angle of rotation(unit: 0.1 degree).
+	int angle;
+	/// Motion interval(unit: micro second), or target velocity for PACKET_ROTATE_BY_VELOCITY.
+	unsigned int interval;
+	/// Acceleration interval, not used by PACKET_ROTATE.
+	unsigned int accInterval;
+	/// Deceleration interval, not used by PACKET_ROTATE.
+	unsigned int decInterval;
+	/// Power output, zero for the power protection value.
+	unsigned int power;
+};
+
+/// Request frame of PACKET_SPIN.
+typedef RequestFrame<PACKET_SPIN, 6> SpinFrame;
+/// Request frame of PACKET_ROTATE.
+typedef RequestFrame<PACKET_ROTATE, 7> RotateFrame;
+/// Request frame of PACKET_ROTATE_BY_INTERVAL.
+typedef RequestFrame<PACKET_ROTATE_BY_INTERVAL, 11> RotateByIntervalFrame;
+/// Request frame of PACKET_ROTATE_BY_VELOCITY.
+typedef RequestFrame<PACKET_ROTATE_BY_VELOCITY, 11> RotateByVelocityFrame;
+/// Request frame of PACKET_DAMPING.
+typedef RequestFrame<PACKET_DAMPING, 3> DampingFrame;
+
+/*!
+ * Encode a spin request, see UARTServo::spin().
+ */
+inline void encodeSpin(SpinFrame& frame, byte id, byte method, unsigned int speed, unsigned int value)
+{
+	frame.put<0>(id);
+	frame.put<1>(method);
+	frame.putUInt<2>(speed);
+	frame.putUInt<4>(value);
+}
+
+/*!
+ * Encode a rotate request, see UARTServo::rotate().
+ */
+inline void encodeRotate(RotateFrame& frame, byte id, int angle, unsigned int interval, unsigned int power)
+{
+	frame.put<0>(id);
+	frame.putInt<1>(angle);
+	frame.putUInt<3>(interval);
+	frame.putUInt<5>(power);
+}
+
+/*!
+ * Encode a rotate by interval or rotate by velocity request, the two share their layout.
+ * See UARTServo::rotateByInterval() and UARTServo::rotateByVelocity().
+ */
+template<byte Number>
+inline void encodeRotateBy(RequestFrame<Number, 11>& frame, byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power)
+{
+	frame.template put<0>(id);
+	frame.template putInt<1>(angle);
+	frame.template putUInt<3>(interval);
+	frame.template putUInt<5>(accInterval);
+	frame.template putUInt<7>(decInterval);
+	frame.template putUInt<9>(power);
+}
+
+/*!
+ * Encode a damping request, see UARTServo::damping().
+ */
+inline void encodeDamping(DampingFrame& frame, byte id, unsigned int power)
+{
+	frame.put<0>(id);
+	frame.putUInt<1>(power);
+}
+
+#ifdef SERVO_STATISTICS
+/// Number of packet numbers counted by ServoStatistics, index 0 counts unknown numbers.
+#define STATISTICS_PACKETS		(PACKET_ROTATE_BY_VELOCITY + 1)
+/// Number of buckets of a latency histogram.
+#define LATENCY_BUCKETS			12
+
+/*!
+ * Bus statistics, see UARTServo::getStatistics().
+ * Checksum errors and discarded bytes point to a bad cable, latencies to a slow servo,
+ * and dropped bytes to a buffer that is too small.
+ */
+struct ServoStatistics
 {
+	/// Response frames dropped by a checksum error.
+	unsigned long checksumErrors;
+	/// Bytes skipped while looking for a response header, noise or the rest of a broken frame.
+	unsigned long discardedBytes;
+	/// Bytes the transport did not accept for sending.
+	unsigned long droppedBytes;
+	/// Valid responses matching no pending request, e.g. late responses after a timeout.
+	unsigned long unexpectedResponses;
+	/// Retries sent.
+	unsigned long retries;
+	/// Requests given up after all retries.
+	unsigned long timeouts;
+	/// Valid responses, by packet number.
+	unsigned long responses[STATISTICS_PACKETS];
+	/*!
+	 * Request-to-response latency histograms, by packet number.
+	 * Bucket 0 counts latencies under 256 micro seconds, bucket i those under 2^(i + 8) micro seconds,
+	 * and the last bucket all slower ones.
+	 */
+	unsigned long latency[STATISTICS_PACKETS][LATENCY_BUCKETS];
+};
+#endif
+
+class UARTServo;
+
+/*!
+ * ResponseHandler class
+ * Receives the raw response of a request sent by UARTServo::sendRequest().
+ */
+class ResponseHandler
+{
+public:
+	virtual ~ResponseHandler() {}
+
 	/*!
-	 * Reserved field, must be set to 1 when write data to the servo.
-	 * Data ID: 32.
-	 * \sa #UARTServo::writeBatchData
+	 * Called when the response arrives.
+	 * 
+	 * \param id Servo ID.
+	 * \param number Packet number.
+	 * \param payload Response payload, starting with the servo ID. It is only valid during this call.
+	 * \param length Payload length.
 	 */
-	byte reserved;
+	virtual void onResponse(byte id, byte number, const byte* payload, byte length) = 0;
+
 	/*!
-	 * In the spin or rotate mode, whether the servo has responded after completing the command.
-	 * If the value is set to non-zero(true), the old command cannot be interrupted by the new command. 
-	 * The waiting commands will be added to a limited queue, if the queue is full, the newest one is discarded.
-	 * If the value is set to zero(false), the past command can be interrupted by the new command 
-	 * and the response packet will not be sent back.
-	 * The default value is zero (false).
-	 * Data ID: 33.
+	 * Called when the request gets no response after all retries.
+	 * 
+	 * \param id Servo ID.
+	 * \param number Packet number.
+	 * \param argument The byte following the servo ID in the request payload (e.g. the data ID of a read data request), zero if there is none.
+	 */
+	virtual void onTimeout(byte id, byte number, byte argument)
+	{
+		(void)id;
+		(void)number;
+		(void)argument;
+	}
+};
+
+/*!
+ * UARTServoTask class
+ * A job run by UARTServo::update() after the received bytes are handled, see UARTServo::attach().
+ */
+class UARTServoTask
+{
+public:
+	UARTServoTask() : _next(NULL) {}
+	virtual ~UARTServoTask() {}
+
+	/*!
+	 * \param servo The object running this task.
+	 * \param now Current time(unit: millisecond).
 	 */
-	byte responsive; 
+	virtual void poll(UARTServo& servo, unsigned long now) = 0;
+
+	/*!
+	 * Time until this task needs to be polled again, for UARTServo::getPollTimeout().
+	 *
+	 * \param now Current time(unit: millisecond).
+	 * \return Delay(unit: millisecond), POLL_IDLE if only a response can give it work. Default value is 1.
+	 */
+	virtual unsigned long getPollDelay(unsigned long now) const
+	{
+		(void)now;
+		return 1;
+	}
+
+private:
+	friend class UARTServo;
+	UARTServoTask* _next;
+};
+
+/*!
+ * UARTServo class
+ * This class is mainly used to read and write the parameters of the data area, 
+ * and provides related functions of three motion modes for the user to drive the servo(s).
+ */
+class UARTServo
+{
+public:
+	UARTServo();
+
 	/*!
-	 * Servo ID.
-	 * Data ID: 34.
+	 * Initializes the UART servo library and communication settings.
+	 * It should be placed in function setup().
+	 * This function is only enable as SOFTWARE_SERIAL be defined.
+	 * 
+	 * \param rxPin Receive pin number. 
+	 * \param txPin Transmit pin number.
+	 * \param baud Transmission rate, default value is BAUD_RATE.
 	 */
-	byte id;
+	void begin(unsigned int rxPin, unsigned int txPin, unsigned long baud = BAUD_RATE);
+
+#ifdef ARDUINO
 	/*!
-	 * Control mode
-	 * Data ID: 35.
+	 * Initializes the UART servo library and communication settings.
+	 * It should be placed in function setup().
+	 * 
+	 * \param serial A pointer to the class HardwareSerial, default value is Serial.
+	 * \param baud Transmission rate, default value is BAUD_RATE.
 	 */
-	byte controlMode;
+	void begin(HardwareSerial* serial = &Serial, unsigned long baud = BAUD_RATE);
+#endif
+
 	/*!
-	 * Connecting rate index.
-	 * 0x01-9600,
-	 * 0x02-19200,
-	 * 0x03-38400,
-	 * 0x04-57600,
-	 * 0x05-115200 (default),
-	 * 0x06-250000,
-	 * 0x07-500000,
-	 * Data ID: 36.
+	 * Initializes the UART servo library over a custom transport,
+	 * e.g. TermiosTransport on Linux or LoopbackTransport in tests.
+	 * 
+	 * \param transport A pointer to the transport, it must stay valid while this object is used.
+	 * \param baud Transmission rate, default value is BAUD_RATE.
+	 * \return true if the transport is opened.
 	 */
-	byte baudIndex;
+	bool begin(UARTTransport* transport, unsigned long baud = BAUD_RATE);
+
 	/*!
-	 * Stall protection.
-	 * Data ID: 37.
+	 * Reopen the transport at another connecting rate, pending requests are kept.
+	 * 
+	 * \param baud Transmission rate.
+	 * \return true if the transport is opened.
 	 */
-	byte stallProtect;
+	bool setBaudRate(unsigned long baud);
+
 	/*!
-	 * Stall power limit.
-	 * Data ID: 38.
+	 * Update data of this class.
+	 * It should be placed in function loop().
+	 * It is the same as onReadable(), onWritable() and onDeadline() in a row.
 	 */
-	unsigned int stallPowerLimit;
+	void update();
+
 	/*!
-	 *
-	 * Data ID: 39.
+	 * Handle the bytes received by the transport, without blocking.
+	 * In an event loop, call it when the file descriptor is readable.
 	 */
-	unsigned int overVoltageLowLevel;
+	void onReadable();
+
 	/*!
-	 *
-	 * Data ID: 40.
+	 * Send the bytes waiting in the transport, without blocking.
+	 * In an event loop, call it when the file descriptor is writable.
 	 */
-	unsigned int overVoltageHighLevel;
+	void onWritable();
+
 	/*!
-	 *
-	 * Data ID: 41.
+	 * Retry or give up requests past their deadlines, and run the tasks.
+	 * In an event loop, call it when the time of getPollTimeout() has passed, or after every wake-up.
 	 */
-	unsigned int overTemperatureTriggerLevel;
+	void onDeadline();
+
 	/*!
+	 * Time until the next deadline of a pending request or a task, the timeout of poll() or epoll_wait().
 	 *
-	 * Data ID: 42.
+	 * \return Time to wait(unit: millisecond), zero if a deadline has passed, -1 if nothing is due until bytes are received.
 	 */
-	unsigned int overPowerTriggerLevel;
+	long getPollTimeout() const;
+
 	/*!
-	 *
-	 * Data ID: 43.
+	 * Whether the transport has bytes waiting for room on the bus, i.e. the event loop should wait for writability.
 	 */
-	unsigned int overCurrentTriggerLevel;
+	bool isWritePending() const;
+
+#ifndef ARDUINO
 	/*!
-	 *
-	 * Data ID: 44.
+	 * File descriptor of the transport, -1 if it has none.
 	 */
-	byte startupSpeed;
+	int getFileDescriptor() const;
+#endif
+
 	/*!
-	 *
-	 * Data ID: 45.
+	 * Feed bytes received from the servos, e.g. when the application reads the transport itself.
+	 * update() calls it with the bytes read from the transport.
+	 * 
+	 * \param data Received bytes.
+	 * \param size Number of received bytes.
 	 */
-	byte brakeSpeed;
+	void feed(const byte* data, size_t size);
+
 	/*!
-	 *
-	 * Data ID: 46.
+	 * Run a task in every update().
+	 * 
+	 * \param task The task, it must stay valid until it is detached.
 	 */
-	byte powerLockSwitch;
+	void attach(UARTServoTask* task);
+
 	/*!
-	 *
-	 * Data ID: 47.
+	 * Stop running a task.
+	 * 
+	 * \param task The task.
 	 */
-	byte wheelModeBrakeSwitch;
+	void detach(UARTServoTask* task);
+
 	/*!
-	 *
-	 * Data ID: 48.
+	 * Send a request whose response is handled by a ResponseHandler.
+	 * It is the raw form of the commands below, for components built on top of this class.
+	 * 
+	 * \param number Packet number.
+	 * \param payload Request payload, starting with the servo ID.
+	 * \param size Payload size.
+	 * \param handler Response handler, NULL if no response is expected.
+	 * \return false if the pending-request table is full, the request is not sent then.
 	 */
-	byte angleLimitSwitch;
+	bool sendRequest(byte number, const byte* payload, byte size, ResponseHandler* handler);
+
 	/*!
-	 *
-	 * Data ID: 49.
+	 * Stop waiting for the response of a request sent by sendRequest(), the handler is not called.
+	 * It lets a component apply deadlines shorter than the request timeout.
+	 * 
+	 * \param id Servo ID.
+	 * \param number Packet number.
+	 * \param handler Response handler given to sendRequest().
+	 * \return false if no such request is pending.
 	 */
-	byte softStartSwitch;
+	bool cancelRequest(byte id, byte number, ResponseHandler* handler);
+
 	/*!
-	 *
-	 * Data ID: 50.
+	 * Number of free slots in the pending-request table.
 	 */
-	unsigned int softStartTime;
+	byte getFreeRequestSlots() const;
+
+	/// Connecting rate given to begin().
+	unsigned long getBaudRate() const;
+
 	/*!
-	 *
-	 * Data ID: 51.
+	 * Connecting rate of a baud rate index, see UserParameter::baudIndex.
+	 * 
+	 * \return Connecting rate, zero for an unknown index.
 	 */
-	int angleUpperLimit;
+	static unsigned long getBaudRate(byte baudIndex);
+
 	/*!
-	 *
-	 * Data ID: 52.
+	 * Time the given number of bytes occupy the wire at the current connecting rate, with 10 bits per byte.
+	 * 
+	 * \param size Number of bytes, including FRAME_OVERHEAD for a frame.
+	 * \return Wire time(unit: micro second).
+	 */
+	unsigned long getWireTime(unsigned int size) const;
+
+	/*!
+	 * Set how long a request waits for its response.
+	 * Idempotent requests (ping(), readData(), readBatchData() and readAngle()) are sent again after a timeout,
+	 * the time to wait is doubled on every retry.
+	 * 
+	 * \param timeout Time to wait for a response(unit: millisecond), zero to wait forever. Default value is REQUEST_TIMEOUT.
+	 * Requests already waiting wait the new time from now.
+	 * \param retries Number of retries of idempotent requests, default value is zero.
+	 */
+	void setTimeout(unsigned long timeout, byte retries = 0);
+
+	/*!
+	 * Set the function called when a request gets no response, after all retries,
+	 * or a malformed one (e.g. a read data response whose value does not have the size of its data ID).
+	 * 
+	 * \param callback Callback function. The parameters in order are Servo ID(byte), and packet number(byte; see PACKET_PING, ...).
 	 */
-	int angleLowerLimit;
+	void setTimeoutCallback(void(*callback)(byte, byte));
+
 	/*!
+	 * Same as setTimeoutCallback(), with a callback taking a context pointer first.
 	 *
-	 * Data ID: 53.
+	 * \param context Context pointer passed to the callback.
 	 */
-	int centerPointOffset;
-};
+	void setTimeoutCallback(void(*callback)(void*, byte, byte), void* context);
 
-/*!
- * UARTServo class
- * This class is mainly used to read and write the parameters of the data area, 
- * and provides related functions of three motion modes for the user to drive the servo(s).
- */
-class UARTServo
-{
-public:
 	/*!
-	 * Initializes the UART servo library and communication settings.
-	 * It should be placed in function setup().
-	 * This function is only enable as SOFTWARE_SERIAL be defined.
+	 * Record the bytes sent and received by this object.
 	 * 
-	 * \param rxPin Receive pin number. 
-	 * \param txPin Transmit pin number.
-	 * \param baud Transmission rate, default value is BAUD_RATE.
+	 * \param capture The capture, NULL to stop capturing. It must stay valid while it is set.
 	 */
-	void begin(unsigned int rxPin, unsigned int txPin, unsigned long baud = BAUD_RATE);
+	void setCapture(BusCapture* capture);
 
+#ifdef SERVO_STATISTICS
 	/*!
-	 * Initializes the UART servo library and communication settings.
-	 * It should be placed in function setup().
+	 * Take a snapshot of the bus statistics.
 	 * 
-	 * \param serial A pointer to the class HardwareSerial, default value is Serial.
-	 * \param baud Transmission rate, default value is BAUD_RATE.
+	 * \param statistics Where the snapshot is copied.
 	 */
-	void begin(HardwareSerial* serial = &Serial, unsigned long baud = BAUD_RATE);
+	void getStatistics(ServoStatistics* statistics) const;
 
 	/*!
-	 * Update data of this class.
-	 * It should be placed in function loop().
+	 * Clear the bus statistics.
 	 */
-	void update();
+	void clearStatistics();
+#endif
 
 	/*!
 	 * Detect status of the specified servo.
 	 * 
 	 * \param id Servo ID.
 	 * \param callback Callback function. The parameter is Servo ID(byte).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool ping(byte id, void(*callback)(byte));
+
+	/*!
+	 * Same as ping(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void ping(byte id, void(*callback)(byte));
+	bool ping(byte id, void(*callback)(void*, byte), void* context);
 
 	/*!
 	 * Reset the parameters of the user area.
 	 * 
 	 * \param id Servo ID.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
 	 */
-	void resetUserData(byte id, void(*callback)(byte, byte));
+	bool resetUserData(byte id, void(*callback)(byte, byte));
+
+	/*!
+	 * Same as resetUserData(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	bool resetUserData(byte id, void(*callback)(void*, byte, byte), void* context);
 	
 	/*!
 	 * Read specified data from the specified servo.
@@ -222,8 +504,44 @@ public:
 	 * \param id Servo ID.
 	 * \param dataID Data ID.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), data id(byte), and data(A const void pointer, data size is packet length - 2).
+	 * A reply to a data ID of the data table with a value of another size is dropped.
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool readData(byte id, byte dataID, void(*callback)(byte, byte, const void*));
+
+	/*!
+	 * Same as readData(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void readData(byte id, byte dataID, void(*callback)(byte, byte, const void*));
+	bool readData(byte id, byte dataID, void(*callback)(void*, byte, byte, const void*), void* context);
+
+	/*!
+	 * Read specified data from the specified servo, decoded to the value type of the data ID.
+	 * e.g. readData<DataId::Voltage>(id, callback) with void callback(byte id, unsigned int voltage).
+	 *
+	 * \tparam Id Data ID.
+	 * \param id Servo ID.
+	 * \param callback Callback function. The parameters in order are Servo ID(byte), and value(DataTraits<Id>::Type).
+	 * A reply of another data ID or with a value of another size is dropped.
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	template<DataId Id>
+	bool readData(byte id, void(*callback)(byte, typename DataTraits<Id>::Type))
+	{
+		return readTypedData(id, (byte)Id, callback);
+	}
+
+	/*!
+	 * Same as readData<Id>(), with a callback taking a context pointer first.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	template<DataId Id>
+	bool readData(byte id, void(*callback)(void*, byte, typename DataTraits<Id>::Type), void* context)
+	{
+		return readTypedData(id, (byte)Id, callback, context);
+	}
 
 	/*!
 	 * Write specified data to the specified servo.
@@ -232,19 +550,35 @@ public:
 	 * 
 	 * \param id Servo ID.
 	 * \param dataID Data ID.
-	 * \param data Written data, a const void pointer point to it.
-	 * \param size Data size.
+	 * \param data Written data, a const void pointer point to it, in little-endian order.
+	 * \param size Data size. For the fields of the data table, at most the size of the field is sent.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), data id(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
 	 */
-	void writeData(byte id, byte dataID, const void* data, size_t size, void(*callback)(byte, byte, byte));
+	bool writeData(byte id, byte dataID, const void* data, size_t size, void(*callback)(byte, byte, byte));
+
+	/*!
+	 * Same as writeData(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	bool writeData(byte id, byte dataID, const void* data, size_t size, void(*callback)(void*, byte, byte, byte), void* context);
 
 	/*!
 	 * Read batch data from the specified servo.
 	 * 
 	 * \param id Servo ID.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte) and data(const UserParameter*).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool readBatchData(byte id, void(*callback)(byte, const UserParameter*));
+
+	/*!
+	 * Same as readBatchData(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void readBatchData(byte id, void(*callback)(byte, const UserParameter*));
+	bool readBatchData(byte id, void(*callback)(void*, byte, const UserParameter*), void* context);
 
 	/*!
 	 * Write batch data to the specified servo.
@@ -252,8 +586,16 @@ public:
 	 * \param id Servo ID.
 	 * \param parameter Servo batch data.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool writeBatchData(byte id, const UserParameter* parameter, void(*callback)(byte, byte));
+
+	/*!
+	 * Same as writeBatchData(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void writeBatchData(byte id, const UserParameter* parameter, void(*callback)(byte, byte));
+	bool writeBatchData(byte id, const UserParameter* parameter, void(*callback)(void*, byte, byte), void* context);
 
 	/*!
 	 * Set the servo to spin mode, and spin by given parameters.
@@ -264,8 +606,16 @@ public:
 	 * \param speed Spin speed(unit: degree/sec.).
 	 * \param value By cycle: The number of turns to be spined(unit: rounds.); by time: The scheduled time to spin(unit: micro second).
 	 * \param callback Callback function. The parameters in order are servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
 	 */
-	void spin(byte id, byte method, unsigned int speed = 0, unsigned int value = 0, void(*callback)(byte, byte) = NULL);
+	bool spin(byte id, byte method, unsigned int speed = 0, unsigned int value = 0, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as spin(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	bool spin(byte id, byte method, unsigned int speed, unsigned int value, void(*callback)(void*, byte, byte), void* context);
 
 	/*!
 	 * Stop All actions of the specified servo and release it. 
@@ -282,8 +632,16 @@ public:
 	 * \param interval Motion interval.(unit: micro second)
 	 * \param power Power output of the servo in this mode, if it is zero or greater than the power protection value, adjust to the power protection value.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
 	 */
-	void rotate(byte id, int angle, unsigned int interval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+	bool rotate(byte id, int angle, unsigned int interval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as rotate(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	bool rotate(byte id, int angle, unsigned int interval, unsigned int power, void(*callback)(void*, byte, byte), void* context);
 
 	/*!
 	 * Set the servo to rotate mode, and roate by given parameters.
@@ -295,8 +653,16 @@ public:
 	 * \param decInterval Deceleration interval.
 	 * \param power Power output of the servo in this mode, if it is zero or greater than the power protection value, adjust to the power protection value.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as rotateByInterval(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+	bool rotateByInterval(byte id, int angle, unsigned int interval, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(void*, byte, byte), void* context);
 	
 	/*!
 	 *  Set the servo to rotate mode, and roate by given parameters.
@@ -308,8 +674,38 @@ public:
 	 * \param decInterval Deceleration interval.
 	 * \param power Power output of the servo in this mode, if it is zero or greater than the power protection value, adjust to the power protection value.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as rotateByVelocity(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+	bool rotateByVelocity(byte id, int angle, unsigned int targetVelocity, unsigned int accInterval, unsigned int decInterval, unsigned int power, void(*callback)(void*, byte, byte), void* context);
+
+	/*!
+	 * Rotate a group of servos at once.
+	 * All frames are encoded back to back and written to the bus together, so the servos start as close together as possible.
+	 * 
+	 * \param motions Motion of each servo.
+	 * \param count Number of motions.
+	 * \param number PACKET_ROTATE, PACKET_ROTATE_BY_INTERVAL or PACKET_ROTATE_BY_VELOCITY.
+	 * \param broadcast If true and all motions are the same except for the ID, send a single frame to ALL_SERVOS instead.
+	 * Only use it when the group holds every servo on the bus. No servo replies to the broadcast frame, so the callback is not called then.
+	 * \param callback Callback function, called once for each servo sent its own frame. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the packet number is not one of the above, nothing is sent then,
+	 * or if the pending-request table is full, the remaining motions are not sent then.
+	 */
+	bool rotateGroup(const ServoMotion* motions, byte count, byte number = PACKET_ROTATE_BY_INTERVAL, bool broadcast = false, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as rotateGroup(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
+	 */
+	bool rotateGroup(const ServoMotion* motions, byte count, byte number, bool broadcast, void(*callback)(void*, byte, byte), void* context);
 
 	/*!
 	 * Set the servo to damping mode.
@@ -318,45 +714,161 @@ public:
 	 * \param id Servo ID.
 	 * \param power Power output of the servo in this mode, if it is zero or greater than the power protection value, adjust to the power protection value.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and result(byte; 1:success, 0:fail).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool damping(byte id, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+
+	/*!
+	 * Same as damping(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void damping(byte id, unsigned int power = 0, void(*callback)(byte, byte) = NULL);
+	bool damping(byte id, unsigned int power, void(*callback)(void*, byte, byte), void* context);
 	
 	/*!
 	 * Read the current angle of the servo.
 	 * 
 	 * \param id Servo ID.
 	 * \param callback Callback function. The parameters in order are Servo ID(byte), and degree(int; unit is 0.1 degree).
+	 * \return false if the pending-request table is full, the request is not sent then.
+	 */
+	bool readAngle(byte id, void(*callback)(byte, int));
+
+	/*!
+	 * Same as readAngle(), with a callback taking a context pointer first, e.g. the object that sent the request.
+	 *
+	 * \param context Context pointer passed to the callback.
 	 */
-	void readAngle(byte id, void(*callback)(byte, int));
+	bool readAngle(byte id, void(*callback)(void*, byte, int), void* context);
 
 private:
 
+	UARTTransport* _transport;
+
+#ifdef ARDUINO
 #ifdef SOFTWARE_SERIAL
-	SoftwareSerial* _serial;
-#else
-	HardwareSerial* _serial;
+	SerialTransport<SoftwareSerial> _softwareTransport;
+	/// The port created by begin(rxPin, txPin) is placed here instead of the heap.
+	alignas(SoftwareSerial) byte _softwareSerialStorage[sizeof(SoftwareSerial)];
+	SoftwareSerial* _softwareSerial;
+#endif
+	SerialTransport<HardwareSerial> _hardwareTransport;
 #endif
 
-	ByteBuffer _txBuffer;
-	ByteBuffer _rxBuffer;
-
-	void(*_pingCallback)(byte);
-	void(*_resetUserDataCallback)(byte, byte);
-	void(*_readDataCallback)(byte, byte, const void*);
-	void(*_writeDataCallback)(byte, byte, byte);
-	void(*_readBatchDataCallback)(byte, const UserParameter*);
-	void(*_writeBatchDataCallback)(byte, byte);
-	void(*_spinCallback)(byte, byte);
-	void(*_rotateCallback)(byte, byte);
-	void(*_dampingCallback)(byte, byte);
-	void(*_readAngleCallback)(byte, int);
-	void(*_rotateByIntervalCallback)(byte, byte);
-	void(*_rotateByVelocityCallback)(byte, byte);
+	byte _txFrame[MAX_FRAME_LENGTH];
+	FrameParser _parser;
+
+	/// Callback of a pending request, the member in use depends on the packet number.
+	union PendingCallback
+	{
+		void(*ping)(byte);
+		void(*result)(byte, byte);
+		void(*readData)(byte, byte, const void*);
+		void(*writeData)(byte, byte, byte);
+		void(*readBatchData)(byte, const UserParameter*);
+		void(*readAngle)(byte, int);
+		/// Callbacks of the typed readData(), the member in use depends on the data ID.
+		void(*readByte)(byte, byte);
+		void(*readUInt)(byte, unsigned int);
+		void(*readInt)(byte, int);
+		void(*readULong)(byte, unsigned long);
+		/// Callbacks taking a context pointer first, see PendingRequest::context.
+		void(*pingContext)(void*, byte);
+		void(*resultContext)(void*, byte, byte);
+		void(*readDataContext)(void*, byte, byte, const void*);
+		void(*writeDataContext)(void*, byte, byte, byte);
+		void(*readBatchDataContext)(void*, byte, const UserParameter*);
+		void(*readAngleContext)(void*, byte, int);
+		void(*readByteContext)(void*, byte, byte);
+		void(*readUIntContext)(void*, byte, unsigned int);
+		void(*readIntContext)(void*, byte, int);
+		void(*readULongContext)(void*, byte, unsigned long);
+	};
+
+	/*!
+	 * A request waiting for its response, keyed by servo ID and packet number,
+	 * and by the data ID for read data and write data requests.
+	 */
+	struct PendingRequest
+	{
+		/// Packet number, zero if this slot is free.
+		byte number;
+		byte id;
+		/// Issue order, the oldest request of the same key is answered first.
+		byte sequence;
+		/// Number of retries sent.
+		byte attempts;
+		/// The byte following the servo ID in the request, the data ID of readData() and writeData().
+		byte argument;
+		/// Whether the callback is one of the typed readData().
+		bool typed;
+		/// Whether the callback takes the context pointer first.
+		bool contextual;
+		void* context;
+		unsigned long deadline;
+#ifdef SERVO_STATISTICS
+		/// Time of the last attempt(unit: micro second).
+		unsigned long sent;
+#endif
+		PendingCallback callback;
+		/// Handler of requests sent by sendRequest(), NULL for the callback of a command.
+		ResponseHandler* handler;
+	};
+
+	unsigned long _baud;
+	PendingRequest _pendingRequests[PENDING_REQUESTS];
+	byte _sequence;
+	unsigned long _timeout;
+	byte _retries;
+	void(*_timeoutCallback)(byte, byte);
+	void(*_timeoutContextCallback)(void*, byte, byte);
+	void* _timeoutContext;
+	UARTServoTask* _tasks;
+	BusCapture* _capture;
+#ifdef SERVO_STATISTICS
+	ServoStatistics _statistics;
+#endif
 
 	void init();
-	void handleByteFromServo(byte data);
-	void makeHeader(byte number, byte size);
-	void writeSerialData();
+	PendingRequest* addPendingRequest(byte id, byte number, byte argument);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte, byte), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte, byte, const void*), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte, byte, byte), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte, const UserParameter*), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(byte, int), byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte), void* context, byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte), void* context, byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte, const void*), void* context, byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte, byte, byte), void* context, byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte, const UserParameter*), void* context, byte argument = 0);
+	bool addPendingRequest(byte id, byte number, void(*callback)(void*, byte, int), void* context, byte argument = 0);
+	bool readTypedData(byte id, byte dataID, void(*callback)(byte, byte));
+	bool readTypedData(byte id, byte dataID, void(*callback)(byte, unsigned int));
+	bool readTypedData(byte id, byte dataID, void(*callback)(byte, int));
+	bool readTypedData(byte id, byte dataID, void(*callback)(byte, unsigned long));
+	bool readTypedData(byte id, byte dataID, void(*callback)(void*, byte, byte), void* context);
+	bool readTypedData(byte id, byte dataID, void(*callback)(void*, byte, unsigned int), void* context);
+	bool readTypedData(byte id, byte dataID, void(*callback)(void*, byte, int), void* context);
+	bool readTypedData(byte id, byte dataID, void(*callback)(void*, byte, unsigned long), void* context);
+	void sendReadData(byte id, byte dataID);
+	void dispatchTypedData(const PendingRequest& request, byte id, byte dataID, const byte* data);
+	static bool isRotateNumber(byte number);
+	static bool isSameMotion(const ServoMotion* motions, byte count);
+	/// Take the oldest request a response answers, false if it answers none.
+	bool takePendingRequest(byte number, const byte* payload, byte length, PendingRequest* request);
+	void checkPendingRequests(unsigned long now);
+	void resendPendingRequest(const PendingRequest* request);
+	/// Time to wait for a retry, twice as long as the previous attempt.
+	unsigned long getRetryWait(byte attempts) const;
+	/// Tell the caller of a request taken from the table that it gets no valid response.
+	void reportFailure(const PendingRequest& request);
+	void handleFrameFromServo(byte number, const byte* payload, byte length);
+#ifdef SERVO_STATISTICS
+	void countResponse(byte number, const PendingRequest* request);
+#endif
+	size_t encodeMotion(byte* dest, size_t capacity, byte number, byte id, const ServoMotion& motion);
+	void writeSerialData(const byte* data, size_t size);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+// UARTTransport.h
+
+#ifndef UARTTRANSPORT_H
+#define UARTTRANSPORT_H
+
+#include "Platform.h"
+
+/*!
+ * UARTTransport class
+ * Byte stream interface between UARTServo and the physical (or virtual) bus.
+ * Reads and writes work on chunks so that one call can move many bytes.
+ */
+class UARTTransport
+{
+public:
+	virtual ~UARTTransport() {}
+
+	/*!
+	 * Open the transport at the given transmission rate.
+	 * It may be called again to change the rate of an opened transport.
+	 *
+	 * \param baud Transmission rate.
+	 * \return true if the transport is ready.
+	 */
+	virtual bool begin(unsigned long baud) = 0;
+
+	/*!
+	 * Close the transport.
+	 */
+	virtual void end() {}
+
+	/*!
+	 * Number of bytes that can be read without blocking.
+	 */
+	virtual size_t available() = 0;
+
+	/*!
+	 * Read received bytes without blocking.
+	 *
+	 * \param dest Destination buffer.
+	 * \param size Capacity of the destination buffer.
+	 * \return Number of bytes read, zero if nothing has been received.
+	 */
+	virtual size_t read(byte* dest, size_t size) = 0;
+
+	/*!
+	 * Write bytes to the bus.
+	 *
+	 * \param src Source buffer.
+	 * \param size Number of bytes to write.
+	 * \return Number of bytes written.
+	 */
+	virtual size_t write(const byte* src, size_t size) = 0;
+
+	/*!
+	 * Number of written bytes waiting in the transport for room on the bus, see writePending().
+	 */
+	virtual size_t getPending() const { return 0; }
+
+	/*!
+	 * Hand the bytes waiting in the transport to the bus, without blocking.
+	 *
+	 * \return Number of bytes still waiting.
+	 */
+	virtual size_t writePending() { return 0; }
+
+#ifndef ARDUINO
+	/*!
+	 * File descriptor to wait on with poll(), epoll or a reactor, -1 if the transport has none.
+	 */
+	virtual int getFileDescriptor() const { return -1; }
+#endif
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "UserData.h"
+
+#define BASIC_DATA_WIDTH(dataID, name, member, width, isSigned) width,
+// Wire width of the basic data, from data ID 1 to 8.
+static const byte BASIC_DATA_WIDTHS[] = { BASIC_DATA_TABLE(BASIC_DATA_WIDTH) };
+#undef BASIC_DATA_WIDTH
+
+bool getUserDataField(byte dataID, byte* offset, byte* width)
+{
+	if (dataID < USER_DATA_FIRST_ID || dataID > USER_DATA_LAST_ID)
+	{
+		return false;
+	}
+	const UserDataField& field = USER_DATA_LAYOUT_TABLE[dataID - USER_DATA_FIRST_ID];
+	*offset = field.offset;
+	*width = field.width;
+	return true;
+}
+
+bool isUserDataSigned(byte dataID)
+{
+	return dataID >= USER_DATA_FIRST_ID && dataID <= USER_DATA_LAST_ID && USER_DATA_LAYOUT_TABLE[dataID - USER_DATA_FIRST_ID].isSigned;
+}
+
+byte getDataSize(byte dataID)
+{
+	if (dataID >= 1 && dataID <= sizeof(BASIC_DATA_WIDTHS))
+	{
+		return BASIC_DATA_WIDTHS[dataID - 1];
+	}
+	if (dataID >= USER_DATA_FIRST_ID && dataID <= USER_DATA_LAST_ID)
+	{
+		return USER_DATA_WIDTHS[dataID - USER_DATA_FIRST_ID];
+	}
+	return 0;
+}
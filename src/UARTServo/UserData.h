@@ -0,0 +1,373 @@
+// UserData.h
+
+#ifndef USERDATA_H
+#define USERDATA_H
+
+#include "Platform.h"
+
+/// First data ID of the user data area.
+#define USER_DATA_FIRST_ID		32
+/// Last data ID of the user data area.
+#define USER_DATA_LAST_ID		53
+/// Number of fields of the user data area.
+#define USER_DATA_FIELDS		(USER_DATA_LAST_ID - USER_DATA_FIRST_ID + 1)
+/// Size of the user data area on the wire.
+#define USER_DATA_SIZE			32
+
+/// Custom parameters.
+struct UserParameter
+{
+	/*!
+	 * Reserved field, must be set to 1 when write data to the servo.
+	 * Data ID: 32.
+	 * \sa #UARTServo::writeBatchData
+	 */
+	byte reserved;
+	/*!
+	 * In the spin or rotate mode, whether the servo has responded after completing the command.
+	 * If the value is set to non-zero(true), the old command cannot be interrupted by the new command. 
+	 * The waiting commands will be added to a limited queue, if the queue is full, the newest one is discarded.
+	 * If the value is set to zero(false), the past command can be interrupted by the new command 
+	 * and the response packet will not be sent back.
+	 * The default value is zero (false).
+	 * Data ID: 33.
+	 */
+	byte responsive; 
+	/*!
+	 * Servo ID.
+	 * Data ID: 34.
+	 */
+	byte id;
+	/*!
+	 * Control mode
+	 * Data ID: 35.
+	 */
+	byte controlMode;
+	/*!
+	 * Connecting rate index.
+	 * 0x01-9600,
+	 * 0x02-19200,
+	 * 0x03-38400,
+	 * 0x04-57600,
+	 * 0x05-115200 (default),
+	 * 0x06-250000,
+	 * 0x07-500000,
+	 * Data ID: 36.
+	 */
+	byte baudIndex;
+	/*!
+	 * Stall protection.
+	 * Data ID: 37.
+	 */
+	byte stallProtect;
+	/*!
+	 * Stall power limit.
+	 * Data ID: 38.
+	 */
+	unsigned int stallPowerLimit;
+	/*!
+	 *
+	 * Data ID: 39.
+	 */
+	unsigned int overVoltageLowLevel;
+	/*!
+	 *
+	 * Data ID: 40.
+	 */
+	unsigned int overVoltageHighLevel;
+	/*!
+	 *
+	 * Data ID: 41.
+	 */
+	unsigned int overTemperatureTriggerLevel;
+	/*!
+	 *
+	 * Data ID: 42.
+	 */
+	unsigned int overPowerTriggerLevel;
+	/*!
+	 *
+	 * Data ID: 43.
+	 */
+	unsigned int overCurrentTriggerLevel;
+	/*!
+	 *
+	 * Data ID: 44.
+	 */
+	byte startupSpeed;
+	/*!
+	 *
+	 * Data ID: 45.
+	 */
+	byte brakeSpeed;
+	/*!
+	 *
+	 * Data ID: 46.
+	 */
+	byte powerLockSwitch;
+	/*!
+	 *
+	 * Data ID: 47.
+	 */
+	byte wheelModeBrakeSwitch;
+	/*!
+	 *
+	 * Data ID: 48.
+	 */
+	byte angleLimitSwitch;
+	/*!
+	 *
+	 * Data ID: 49.
+	 */
+	byte softStartSwitch;
+	/*!
+	 *
+	 * Data ID: 50.
+	 */
+	unsigned int softStartTime;
+	/*!
+	 *
+	 * Data ID: 51.
+	 */
+	int angleUpperLimit;
+	/*!
+	 *
+	 * Data ID: 52.
+	 */
+	int angleLowerLimit;
+	/*!
+	 *
+	 * Data ID: 53.
+	 */
+	int centerPointOffset;
+};
+
+/*!
+ * Basic data (read only), in the same form as USER_DATA_TABLE. The member names the value in snapshots.
+ */
+#define BASIC_DATA_TABLE(FIELD) \
+	FIELD(1, Voltage, voltage, 2, false) \
+	FIELD(2, Current, current, 2, false) \
+	FIELD(3, Power, power, 2, false) \
+	FIELD(4, Temperature, temperature, 2, false) \
+	FIELD(5, Status, status, 1, false) \
+	FIELD(6, Model, model, 2, false) \
+	FIELD(7, FirmwareVersion, firmwareVersion, 2, false) \
+	FIELD(8, SerialNumber, serialNumber, 4, false)
+
+/*!
+ * Fields of the user data area in wire order: data ID, name in DataId, member of UserParameter, wire width and signedness.
+ * It is the single description of the area, the layout table and the codec below are generated from it.
+ */
+#define USER_DATA_TABLE(FIELD) \
+	FIELD(32, Reserved, reserved, 1, false) \
+	FIELD(33, Responsive, responsive, 1, false) \
+	FIELD(34, Id, id, 1, false) \
+	FIELD(35, ControlMode, controlMode, 1, false) \
+	FIELD(36, BaudIndex, baudIndex, 1, false) \
+	FIELD(37, StallProtect, stallProtect, 1, false) \
+	FIELD(38, StallPowerLimit, stallPowerLimit, 2, false) \
+	FIELD(39, OverVoltageLowLevel, overVoltageLowLevel, 2, false) \
+	FIELD(40, OverVoltageHighLevel, overVoltageHighLevel, 2, false) \
+	FIELD(41, OverTemperatureTriggerLevel, overTemperatureTriggerLevel, 2, false) \
+	FIELD(42, OverPowerTriggerLevel, overPowerTriggerLevel, 2, false) \
+	FIELD(43, OverCurrentTriggerLevel, overCurrentTriggerLevel, 2, false) \
+	FIELD(44, StartupSpeed, startupSpeed, 1, false) \
+	FIELD(45, BrakeSpeed, brakeSpeed, 1, false) \
+	FIELD(46, PowerLockSwitch, powerLockSwitch, 1, false) \
+	FIELD(47, WheelModeBrakeSwitch, wheelModeBrakeSwitch, 1, false) \
+	FIELD(48, AngleLimitSwitch, angleLimitSwitch, 1, false) \
+	FIELD(49, SoftStartSwitch, softStartSwitch, 1, false) \
+	FIELD(50, SoftStartTime, softStartTime, 2, false) \
+	FIELD(51, AngleUpperLimit, angleUpperLimit, 2, true) \
+	FIELD(52, AngleLowerLimit, angleLowerLimit, 2, true) \
+	FIELD(53, CenterPointOffset, centerPointOffset, 2, true)
+
+/// Layout of a user data field on the wire.
+struct UserDataField
+{
+	byte dataID;
+	byte offset;
+	byte width;
+	bool isSigned;
+};
+
+#define USER_DATA_WIDTH(dataID, name, member, width, isSigned) width,
+/// Wire width of each user data field.
+constexpr byte USER_DATA_WIDTHS[USER_DATA_FIELDS] = { USER_DATA_TABLE(USER_DATA_WIDTH) };
+#undef USER_DATA_WIDTH
+
+/*!
+ * Offset of a user data field on the wire, a constant expression.
+ */
+constexpr byte userDataOffset(byte dataID)
+{
+	return (dataID <= USER_DATA_FIRST_ID) ? 0 : userDataOffset(dataID - 1) + USER_DATA_WIDTHS[dataID - 1 - USER_DATA_FIRST_ID];
+}
+
+#define USER_DATA_LAYOUT(dataID, name, member, width, isSigned) { dataID, userDataOffset(dataID), width, isSigned },
+/// Layout of each user data field, indexed by data ID - USER_DATA_FIRST_ID.
+constexpr UserDataField USER_DATA_LAYOUT_TABLE[USER_DATA_FIELDS] = { USER_DATA_TABLE(USER_DATA_LAYOUT) };
+#undef USER_DATA_LAYOUT
+
+static_assert(userDataOffset(USER_DATA_LAST_ID) + USER_DATA_WIDTHS[USER_DATA_FIELDS - 1] == USER_DATA_SIZE,
+	"the user data fields must fill USER_DATA_SIZE bytes");
+
+/// Little-endian access to a value of the given wire width and signedness, Type is the value type.
+template<byte Width, bool Signed>
+struct DataWire;
+
+template<>
+struct DataWire<1, false>
+{
+	typedef byte Type;
+
+	template<byte Offset>
+	static void write(byte* dest, unsigned int value)
+	{
+		dest[Offset] = (byte)value;
+	}
+
+	template<byte Offset>
+	static byte read(const byte* src)
+	{
+		return src[Offset];
+	}
+};
+
+template<>
+struct DataWire<2, false>
+{
+	typedef unsigned int Type;
+
+	template<byte Offset>
+	static void write(byte* dest, unsigned int value)
+	{
+		dest[Offset] = (byte)value;
+		dest[Offset + 1] = (byte)(value >> 8);
+	}
+
+	template<byte Offset>
+	static uint16_t read(const byte* src)
+	{
+		return (uint16_t)(src[Offset] | (src[Offset + 1] << 8));
+	}
+};
+
+template<>
+struct DataWire<2, true>
+{
+	typedef int Type;
+
+	template<byte Offset>
+	static void write(byte* dest, int value)
+	{
+		dest[Offset] = (byte)value;
+		dest[Offset + 1] = (byte)(value >> 8);
+	}
+
+	template<byte Offset>
+	static int16_t read(const byte* src)
+	{
+		return (int16_t)(src[Offset] | (src[Offset + 1] << 8));
+	}
+};
+
+template<>
+struct DataWire<4, false>
+{
+	typedef unsigned long Type;
+
+	template<byte Offset>
+	static void write(byte* dest, unsigned long value)
+	{
+		for (byte i = 0; i < 4; i++)
+		{
+			dest[Offset + i] = (byte)(value >> (i * 8));
+		}
+	}
+
+	template<byte Offset>
+	static unsigned long read(const byte* src)
+	{
+		return (unsigned long)src[Offset] | ((unsigned long)src[Offset + 1] << 8)
+			| ((unsigned long)src[Offset + 2] << 16) | ((unsigned long)src[Offset + 3] << 24);
+	}
+};
+
+#define DATA_ID(dataID, name, member, width, isSigned) name = dataID,
+/// Data IDs of the data table (see uart-servo-data-table.md), for the typed UARTServo::readData().
+enum class DataId : byte
+{
+	BASIC_DATA_TABLE(DATA_ID)
+	USER_DATA_TABLE(DATA_ID)
+};
+#undef DATA_ID
+
+/*!
+ * Compile-time description of a data ID: its wire size SIZE, its value Type and read<0>() to decode it in place.
+ */
+template<DataId Id>
+struct DataTraits;
+
+#define DATA_TRAITS(dataID, name, member, width, isSigned) \
+	template<> \
+	struct DataTraits<DataId::name> : DataWire<width, isSigned> \
+	{ \
+		static const byte SIZE = width; \
+	};
+BASIC_DATA_TABLE(DATA_TRAITS)
+USER_DATA_TABLE(DATA_TRAITS)
+#undef DATA_TRAITS
+
+/*!
+ * Encode user data in its wire layout, one straight store per field.
+ *
+ * \param parameter User data.
+ * \param dest Destination of USER_DATA_SIZE bytes.
+ */
+inline void encodeUserParameter(const UserParameter* parameter, byte* dest)
+{
+#define USER_DATA_ENCODE(dataID, name, member, width, isSigned) \
+	DataWire<width, isSigned>::write<userDataOffset(dataID)>(dest, parameter->member);
+	USER_DATA_TABLE(USER_DATA_ENCODE)
+#undef USER_DATA_ENCODE
+}
+
+/*!
+ * Decode user data from its wire layout, one straight load per field.
+ *
+ * \param src Source of USER_DATA_SIZE bytes.
+ * \param parameter User data.
+ */
+inline void decodeUserParameter(const byte* src, UserParameter* parameter)
+{
+#define USER_DATA_DECODE(dataID, name, member, width, isSigned) \
+	parameter->member = DataWire<width, isSigned>::read<userDataOffset(dataID)>(src);
+	USER_DATA_TABLE(USER_DATA_DECODE)
+#undef USER_DATA_DECODE
+}
+
+/*!
+ * Locate a field of the user data area in its wire layout, the payload of the batch data commands.
+ *
+ * \param dataID Data ID, from USER_DATA_FIRST_ID to USER_DATA_LAST_ID.
+ * \param offset Offset of the field.
+ * \param width Size of the field, 1 or 2 bytes.
+ * \return false if the data ID is not in the user data area.
+ */
+bool getUserDataField(byte dataID, byte* offset, byte* width);
+
+/*!
+ * Whether a field of the user data area is signed, i.e. the angle limits and the center point offset.
+ */
+bool isUserDataSigned(byte dataID);
+
+/*!
+ * Wire size of a value of the data table (see uart-servo-data-table.md), for data IDs 1-8 and 32-53.
+ *
+ * \return Size in bytes, zero for an unknown data ID.
+ */
+byte getDataSize(byte dataID);
+
+#endif